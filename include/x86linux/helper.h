@@ -29,6 +29,7 @@
 #include <sys/user.h>
 
 #include <linux/futex.h>
+#include <linux/ioctl.h>
 
 #include <x86intrin.h>
 
@@ -95,6 +96,12 @@ extern "C" {
 /* It uses compile-time definition of `PAGE_SIZE`. */
 #define align_val_page(val) align_val_pow2(val, PAGE_SIZE)
 
+#ifndef __KERNEL__
+/* Same as the kernel definitions */
+#define L1_CACHE_BYTES 64
+#define ____cacheline_aligned __attribute((__aligned__(L1_CACHE_BYTES)))
+#endif
+
 /* Casting */
 
 #define address_cast(value) ((void *)(uintptr_t)(value))
@@ -148,8 +155,23 @@ filenameat(const char *restrict dirpath, const char *restrict path) {
 
 /* memvcmp() */
 
+/*
+ * Return the offset of the first byte other than `c` in `s`, or `n` if there
+ * is no one (AVX2/AVX-512 if available at runtime in user space).
+ */
+__attribute((pure)) size_t memvspn(const void *restrict s, unsigned char c,
+                                   size_t n);
+/* Buffers of this size or more are compared by memvspn() (in user space). */
+#define MEMVCMP_VSPN_MIN 256
+
 static __always_inline __attribute((pure)) int
 memvcmp(const void *restrict s, unsigned char c, size_t n) {
+#ifndef __KERNEL__
+  if (n >= MEMVCMP_VSPN_MIN) {
+    const size_t __off = memvspn(s, c, n);
+    return __off == n ? 0 : *((const unsigned char *)s + __off) - c;
+  }
+#endif
   if (likely(n)) {
     const unsigned char *const restrict __s = (typeof(__s))s;
     const unsigned char __r = *__s - c;
@@ -158,6 +180,20 @@ memvcmp(const void *restrict s, unsigned char c, size_t n) {
   return 0;
 }
 
+/* memcpy_tiered() */
+
+/* Default thresholds of memcpy_tiered() */
+#define MEMCPY_VEC_MIN 256          // Vector (AVX2/AVX-512) moves
+#define MEMCPY_NT_MIN (256 * 1024)  // Non-temporal (streaming) stores
+
+/*
+ * Copy with inline moves under `vec_min` byte(s), vector moves under `nt_min`
+ * byte(s), and non-temporal stores (followed by SFENCE) otherwise; The latter
+ * does not pull `dest` into the cache (vector ones are user space only).
+ */
+void *memcpy_tiered(void *restrict dest, const void *restrict src, size_t n,
+                    size_t vec_min, size_t nt_min);
+
 /* Bitset operations */
 
 typedef uint64_t bitset_t;
@@ -198,6 +234,313 @@ int32_t bitset_search_lowest(const bitset_t *restrict bitset,
 int32_t bitset_search_lowest_common(const bitset_t *restrict bitset,
                                     const bitset_t *restrict bitset2,
                                     uint32_t start_idx, uint32_t last_idx);
+/* Search the lowest unset bit within [start_idx, last_idx]. */
+int32_t bitset_search_lowest_zero(const bitset_t *restrict bitset,
+                                  uint32_t start_idx, uint32_t last_idx);
+/*
+ * Search the highest set bit within [start_idx, last_idx].
+ *
+ * (use this with `start_idx` as 0 for the reverse search from `last_idx`)
+ */
+int32_t bitset_search_highest(const bitset_t *restrict bitset,
+                              uint32_t start_idx, uint32_t last_idx);
+/* Generalization of bitset_search_lowest_common() to `nr_bitsets` bitsets */
+int32_t bitset_search_lowest_common_n(const bitset_t *const *restrict bitsets,
+                                      uint32_t nr_bitsets, uint32_t start_idx,
+                                      uint32_t last_idx);
+
+/*
+ * Store the indexes of set bits within [start_idx, last_idx] (at most `nr`) to
+ * `idxs` in ascending order in one pass.
+ *
+ * Return the number of stored indexes.
+ */
+uint32_t bitset_extract(const bitset_t *restrict bitset, uint32_t start_idx,
+                        uint32_t last_idx, uint32_t *restrict idxs,
+                        uint32_t nr);
+
+/* Iterator over set bits */
+struct bitset_iter {
+  const bitset_t *restrict bitset;
+  bitset_t word; // Remaining bits of the current word
+  uint32_t idx;  // Index of the current word
+  uint32_t last_idx;
+};
+static __always_inline void bitset_iter_init(struct bitset_iter *restrict iter,
+                                             const bitset_t *restrict bitset,
+                                             uint32_t start_idx,
+                                             uint32_t last_idx) {
+  iter->bitset = bitset;
+  iter->idx = start_idx >> 6;
+  iter->last_idx = last_idx;
+  iter->word = unlikely(start_idx > last_idx)
+                   ? 0
+                   : *(bitset + iter->idx) & (UINT64_MAX << (start_idx & 0x3F));
+}
+/* Return the next set bit, or -1 if there is no more. */
+static __always_inline int32_t
+bitset_iter_next(struct bitset_iter *restrict iter) {
+  if (unlikely(!iter->word)) {
+    /* Skip the empty words with the (vectorized) search. */
+    if (iter->idx >= (iter->last_idx >> 6))
+      return -1;
+    const int32_t __next = bitset_search_lowest(
+        iter->bitset, (iter->idx + 1) << 6, iter->last_idx);
+    if (__next == -1) {
+      iter->idx = iter->last_idx >> 6;
+      return -1;
+    }
+    iter->idx = __next >> 6;
+    iter->word = *(iter->bitset + iter->idx);
+  }
+
+  const uint32_t __idx = (iter->idx << 6) + __builtin_ctzll(iter->word);
+  if (unlikely(__idx > iter->last_idx)) {
+    iter->word = 0;
+    iter->idx = iter->last_idx >> 6;
+    return -1;
+  }
+  iter->word &= iter->word - 1;
+  return __idx;
+}
+/*
+ * Iterate `idx` (int32_t) over set bits within [start_idx, last_idx].
+ *
+ * @param iter (struct bitset_iter *restrict) Iterator to use
+ */
+#define bitset_for_each(idx, iter, bitset, start_idx, last_idx)                \
+  for (bitset_iter_init(iter, bitset, start_idx, last_idx);                   \
+       ((idx) = bitset_iter_next(iter)) != -1;)
+
+/*
+ * Bulk operations within [start_idx, last_idx] (bits out of the range in the
+ * edge words are preserved)
+ */
+
+/* dest &= src */
+void bitset_and(bitset_t *restrict dest, const bitset_t *restrict src,
+                uint32_t start_idx, uint32_t last_idx);
+/* dest |= src */
+void bitset_or(bitset_t *restrict dest, const bitset_t *restrict src,
+               uint32_t start_idx, uint32_t last_idx);
+/* dest ^= src */
+void bitset_xor(bitset_t *restrict dest, const bitset_t *restrict src,
+                uint32_t start_idx, uint32_t last_idx);
+/* dest &= ~src */
+void bitset_andnot(bitset_t *restrict dest, const bitset_t *restrict src,
+                   uint32_t start_idx, uint32_t last_idx);
+
+void bitset_set_range(bitset_t *restrict bitset, uint32_t start_idx,
+                      uint32_t last_idx);
+void bitset_unset_range(bitset_t *restrict bitset, uint32_t start_idx,
+                        uint32_t last_idx);
+
+/* Return the number of set bits. */
+uint64_t bitset_count(const bitset_t *restrict bitset, uint32_t start_idx,
+                      uint32_t last_idx);
+
+/*
+ * 64-bit indexed variants of the above (-1 is still the not-found value as
+ * the index is unlikely to reach INT64_MAX)
+ */
+
+unsigned char bitset_test64(const bitset_t *restrict bitset, uint64_t idx);
+unsigned char bitset_set64(bitset_t *restrict bitset, uint64_t idx);
+static __always_inline unsigned char
+bitset_set_atomic64(volatile bitset_t *restrict bitset, uint64_t idx) {
+  register unsigned char __cf asm("al");
+  asm volatile("lock btsq %2, %1\n\t"
+               "setc %0"
+               : "=a"(__cf), "+m"(*bitset)
+               : "Jr"(idx)
+               : "cc", "memory"); // This includes full memory barrier.
+  return __cf;
+}
+unsigned char bitset_unset64(bitset_t *restrict bitset, uint64_t idx);
+static __always_inline unsigned char
+bitset_unset_atomic64(volatile bitset_t *restrict bitset, uint64_t idx) {
+  register unsigned char __cf asm("al");
+  asm volatile("lock btrq %2, %1\n\t"
+               "setc %0"
+               : "=a"(__cf), "+m"(*bitset)
+               : "Jr"(idx)
+               : "cc", "memory"); // This includes full memory barrier.
+  return __cf;
+}
+
+int64_t bitset_search_lowest64(const bitset_t *restrict bitset,
+                               uint64_t start_idx, uint64_t last_idx);
+int64_t bitset_search_lowest_common64(const bitset_t *restrict bitset,
+                                      const bitset_t *restrict bitset2,
+                                      uint64_t start_idx, uint64_t last_idx);
+int64_t bitset_search_lowest_zero64(const bitset_t *restrict bitset,
+                                    uint64_t start_idx, uint64_t last_idx);
+int64_t bitset_search_highest64(const bitset_t *restrict bitset,
+                                uint64_t start_idx, uint64_t last_idx);
+
+uint32_t bitset_extract64(const bitset_t *restrict bitset, uint64_t start_idx,
+                          uint64_t last_idx, uint64_t *restrict idxs,
+                          uint32_t nr);
+
+struct bitset_iter64 {
+  const bitset_t *restrict bitset;
+  bitset_t word; // Remaining bits of the current word
+  uint64_t idx;  // Index of the current word
+  uint64_t last_idx;
+};
+static __always_inline void
+bitset_iter_init64(struct bitset_iter64 *restrict iter,
+                   const bitset_t *restrict bitset, uint64_t start_idx,
+                   uint64_t last_idx) {
+  iter->bitset = bitset;
+  iter->idx = start_idx >> 6;
+  iter->last_idx = last_idx;
+  iter->word = unlikely(start_idx > last_idx)
+                   ? 0
+                   : *(bitset + iter->idx) & (UINT64_MAX << (start_idx & 0x3F));
+}
+static __always_inline int64_t
+bitset_iter_next64(struct bitset_iter64 *restrict iter) {
+  if (unlikely(!iter->word)) {
+    if (iter->idx >= (iter->last_idx >> 6))
+      return -1;
+    const int64_t __next = bitset_search_lowest64(
+        iter->bitset, (iter->idx + 1) << 6, iter->last_idx);
+    if (__next == -1) {
+      iter->idx = iter->last_idx >> 6;
+      return -1;
+    }
+    iter->idx = __next >> 6;
+    iter->word = *(iter->bitset + iter->idx);
+  }
+
+  const uint64_t __idx = (iter->idx << 6) + __builtin_ctzll(iter->word);
+  if (unlikely(__idx > iter->last_idx)) {
+    iter->word = 0;
+    iter->idx = iter->last_idx >> 6;
+    return -1;
+  }
+  iter->word &= iter->word - 1;
+  return __idx;
+}
+/* @param iter (struct bitset_iter64 *restrict) Iterator to use */
+#define bitset_for_each64(idx, iter, bitset, start_idx, last_idx)              \
+  for (bitset_iter_init64(iter, bitset, start_idx, last_idx);                 \
+       ((idx) = bitset_iter_next64(iter)) != -1;)
+
+void bitset_and64(bitset_t *restrict dest, const bitset_t *restrict src,
+                  uint64_t start_idx, uint64_t last_idx);
+void bitset_or64(bitset_t *restrict dest, const bitset_t *restrict src,
+                 uint64_t start_idx, uint64_t last_idx);
+void bitset_xor64(bitset_t *restrict dest, const bitset_t *restrict src,
+                  uint64_t start_idx, uint64_t last_idx);
+void bitset_andnot64(bitset_t *restrict dest, const bitset_t *restrict src,
+                     uint64_t start_idx, uint64_t last_idx);
+
+void bitset_set_range64(bitset_t *restrict bitset, uint64_t start_idx,
+                        uint64_t last_idx);
+void bitset_unset_range64(bitset_t *restrict bitset, uint64_t start_idx,
+                          uint64_t last_idx);
+
+uint64_t bitset_count64(const bitset_t *restrict bitset, uint64_t start_idx,
+                        uint64_t last_idx);
+
+/*
+ * For each of `nr_pages` pages (of `page_size` byte(s)) from `s`, set the bit
+ * of `bitset` if the page has any byte other than `c` (usually 0), or unset it
+ * otherwise.
+ *
+ * Return the number of set bits.
+ */
+uint64_t memvcmp_pages(const void *restrict s, unsigned char c,
+                       size_t page_size, uint64_t nr_pages,
+                       bitset_t *restrict bitset);
+
+/* Hierarchical bitset */
+
+/* Enough levels for 2^32 bits (64^6 = 2^36) */
+#define BITSET_HIER_LEVEL_MAX 6
+/*
+ * Multi-level bitset where each bit of the upper level tells whether the
+ * corresponding 64-bit word of the level below is non-empty
+ *
+ * `level[0]` is the leaf level, which can be used with the flat bitset
+ * functions as read-only.
+ */
+struct bitset_hier {
+  bitset_t *restrict level[BITSET_HIER_LEVEL_MAX];
+  uint32_t nr_bits;
+  uint32_t nr_levels;
+};
+
+/* Return the size (in byte(s)) of memory for all levels of `nr_bits`. */
+size_t bitset_hier_size(uint32_t nr_bits);
+/* `bitset` should be at least bitset_hier_size(nr_bits) bytes; It is zeroed. */
+void bitset_hier_init(struct bitset_hier *restrict hier,
+                      bitset_t *restrict bitset, uint32_t nr_bits);
+
+static __always_inline unsigned char
+bitset_hier_test(const struct bitset_hier *restrict hier, uint32_t idx) {
+  return bitset_test(hier->level[0], idx);
+}
+
+unsigned char bitset_hier_set(struct bitset_hier *restrict hier, uint32_t idx);
+unsigned char bitset_hier_unset(struct bitset_hier *restrict hier,
+                                uint32_t idx);
+/*
+ * The upper levels may be stale (but never lose the non-empty word) while the
+ * concurrent set/unset is in progress; The search skips such a stale bit.
+ */
+unsigned char bitset_hier_set_atomic(struct bitset_hier *restrict hier,
+                                     uint32_t idx);
+unsigned char bitset_hier_unset_atomic(struct bitset_hier *restrict hier,
+                                       uint32_t idx);
+
+/* It costs O(log64(n)) regardless of the sparseness. */
+int32_t bitset_hier_search_lowest(const struct bitset_hier *restrict hier,
+                                  uint32_t start_idx, uint32_t last_idx);
+
+/* Lock-free ID allocator */
+
+/* Per-CPU search hint (separated by cache line) */
+struct bitset_idalloc_hint {
+  volatile uint32_t idx;
+} ____cacheline_aligned;
+/*
+ * Allocator of IDs in [0, nr_bits) where the set bit of `bitset` means free
+ *
+ * Each CPU starts searching from its own hint (the next of the last ID it got,
+ * or the last ID it put) so that CPUs do not contend on the same word.
+ */
+struct bitset_idalloc {
+  volatile bitset_t *restrict bitset;
+  struct bitset_idalloc_hint *restrict hints;
+  uint32_t nr_bits;
+  uint32_t nr_hints;
+};
+
+/*
+ * `bitset` should be at least BITSET_SIZE(nr_bits) bytes; All IDs become free.
+ * `nr_hints` should be power of 2 (usually the number of CPUs).
+ */
+void bitset_idalloc_init(struct bitset_idalloc *restrict idalloc,
+                         bitset_t *restrict bitset, uint32_t nr_bits,
+                         struct bitset_idalloc_hint *restrict hints,
+                         uint32_t nr_hints);
+
+/* Return the claimed ID, or -1 if exhausted. */
+int32_t bitset_idalloc_get(struct bitset_idalloc *restrict idalloc);
+void bitset_idalloc_put(struct bitset_idalloc *restrict idalloc, uint32_t idx);
+/*
+ * Claim up to `nr` IDs (up to 64 at once per word with CMPXCHG) into `idxs`.
+ *
+ * Return the number of IDs claimed.
+ */
+uint32_t bitset_idalloc_get_batch(struct bitset_idalloc *restrict idalloc,
+                                  uint32_t *restrict idxs, uint32_t nr);
+/* IDs in the same word (if adjacent in `idxs`) are put with one LOCK OR. */
+void bitset_idalloc_put_batch(struct bitset_idalloc *restrict idalloc,
+                              const uint32_t *restrict idxs, uint32_t nr);
 
 /* Logger */
 
@@ -218,7 +561,10 @@ uint32_t spsc_write_peek(uint32_t pos_r, uint32_t pos_w, uint32_t pos_end,
 /* Currently, it includes full memory barrier. */
 uint32_t spsc_read(const void *restrict buf, void *restrict dest,
                    uint32_t *restrict pos_r, uint32_t size);
-/* Currently, it includes full memory barrier. */
+/*
+ * Currently, it includes full memory barrier.
+ * (copied by memcpy_tiered() with the default thresholds)
+ */
 uint32_t spsc_write(void *restrict buf, const void *restrict src,
                     uint32_t *restrict pos_w, uint32_t size);
 
@@ -229,6 +575,220 @@ int spsc_rewind_read(uint32_t pos_start, uint32_t *restrict pos_r,
 int spsc_rewind_write(uint32_t pos_start, uint32_t pos_r,
                       uint32_t *restrict pos_w, uint32_t pos_end);
 
+/* SPSC ring */
+
+/*
+ * SPSC ring (of a non-power-of-2 size) whose data is placed at `offset` from
+ * the ring itself, so the whole can be shared as is
+ *
+ * Each side owns a cache line with its cursor and the cached copy of the
+ * opposite cursor, which is re-read (acquire) only when the ring looks full or
+ * empty. The cursor is published with release store (plain MOV on x86).
+ */
+struct spsc_ring {
+  /* Producer side */
+  uint32_t pos_w ____cacheline_aligned;
+  uint32_t pos_w_next; // Committed but not yet published
+  uint32_t pos_r_cache;
+  /* Consumer side */
+  uint32_t pos_r ____cacheline_aligned;
+  uint32_t pos_r_next; // Released but not yet published
+  uint32_t pos_w_cache;
+  /* Read-only after init */
+  uint32_t size ____cacheline_aligned; // 1 byte is left to tell full from empty
+  uint32_t offset;
+  uint32_t flags;
+  uint32_t copy_vec_min; // See memcpy_tiered().
+  uint32_t copy_nt_min;
+  /* Sleeping sides (rarely written) */
+  uint32_t waiters ____cacheline_aligned;
+};
+/* The data is mapped twice back to back (see spsc_ring_mirror_open()). */
+#define SPSC_RING_MIRRORED 0x1
+/* spsc_ring_peek() prefetches the following published data. */
+#define SPSC_RING_PREFETCH 0x2
+#define SPSC_RING_PREFETCH_SIZE 256
+/* `waiters` bits */
+#define SPSC_RING_WAIT_READ 0x1     // The consumer sleeps on `pos_w`.
+#define SPSC_RING_WAIT_WRITE 0x2    // The producer sleeps on `pos_r`.
+#define SPSC_RING_WAIT_DOORBELL 0x4 // The consumer armed the doorbell.
+
+/* The data of `size` byte(s) should start at `offset` from `ring`. */
+void spsc_ring_init(struct spsc_ring *restrict ring, uint32_t offset,
+                    uint32_t size);
+static __always_inline void *spsc_ring_buf(const struct spsc_ring *ring) {
+  return (unsigned char *)ring + ring->offset;
+}
+/*
+ * Tune the copy thresholds of spsc_ring_write() (spsc_ring_read() never uses
+ * non-temporal stores), and enable SPSC_RING_PREFETCH if `prefetch`.
+ * (MEMCPY_VEC_MIN and MEMCPY_NT_MIN by default)
+ */
+void spsc_ring_init_copy(struct spsc_ring *restrict ring, uint32_t vec_min,
+                         uint32_t nt_min, int prefetch);
+
+/* Copy up to `size` byte(s) (across the end) and return the copied size. */
+uint32_t spsc_ring_write(struct spsc_ring *restrict ring,
+                         const void *restrict src, uint32_t size);
+/* Copy up to `size` byte(s) (across the end) and return the copied size. */
+uint32_t spsc_ring_read(struct spsc_ring *restrict ring, void *restrict dest,
+                        uint32_t size);
+
+/*
+ * Zero-copy access: Return the pointer to the contiguous free (or used) space
+ * and store its size (up to `*size`) to `*size`, or NULL if there is no space.
+ * (the whole free (or used) space is contiguous if SPSC_RING_MIRRORED)
+ *
+ * Committed (or released) space is published at once by spsc_ring_publish_*()
+ * (so multiple messages can be published with one cursor update).
+ */
+void *spsc_ring_reserve(struct spsc_ring *restrict ring,
+                        uint32_t *restrict size);
+static __always_inline void spsc_ring_commit(struct spsc_ring *restrict ring,
+                                             uint32_t size) {
+  ring->pos_w_next += size;
+  if (ring->pos_w_next >= ring->size)
+    ring->pos_w_next -= ring->size;
+}
+static __always_inline void
+spsc_ring_publish_write(struct spsc_ring *restrict ring) {
+  __atomic_store_n(&ring->pos_w, ring->pos_w_next, __ATOMIC_RELEASE);
+}
+const void *spsc_ring_peek(struct spsc_ring *restrict ring,
+                           uint32_t *restrict size);
+static __always_inline void spsc_ring_release(struct spsc_ring *restrict ring,
+                                              uint32_t size) {
+  ring->pos_r_next += size;
+  if (ring->pos_r_next >= ring->size)
+    ring->pos_r_next -= ring->size;
+}
+static __always_inline void
+spsc_ring_publish_read(struct spsc_ring *restrict ring) {
+  __atomic_store_n(&ring->pos_r, ring->pos_r_next, __ATOMIC_RELEASE);
+}
+
+/*
+ * Record framing on the SPSC ring
+ *
+ * Each record is contiguous with the header and aligned to SPSC_RECORD_ALIGN,
+ * and the tail which cannot hold the next record is filled with the padding
+ * record, which is skipped by the consumer. The ring size (and the data
+ * address) should be aligned to SPSC_RECORD_ALIGN.
+ */
+#define SPSC_RECORD_ALIGN 8
+#define SPSC_RECORD_PAD UINT32_MAX
+struct spsc_record {
+  uint32_t size; // Total size including the header and alignment
+  uint32_t len;  // Length of the payload (SPSC_RECORD_PAD if padding)
+};
+#define SPSC_RECORD_SIZE(len)                                                  \
+  align_val_pow2(sizeof(struct spsc_record) + (len), SPSC_RECORD_ALIGN)
+
+/* Return the payload of `len` byte(s), or NULL if there is no space. */
+void *spsc_ring_record_reserve(struct spsc_ring *restrict ring, uint32_t len);
+/* Commit the reserved record (publish it with spsc_ring_publish_write()). */
+static __always_inline void
+spsc_ring_record_commit(struct spsc_ring *restrict ring) {
+  spsc_ring_commit(ring, ((const struct spsc_record *)(
+                              (unsigned char *)spsc_ring_buf(ring) +
+                              ring->pos_w_next))
+                             ->size);
+}
+/* Return the payload and store its length to `*len`, or NULL if empty. */
+const void *spsc_ring_record_peek(struct spsc_ring *restrict ring,
+                                  uint32_t *restrict len);
+/* Release the peeked record (publish it with spsc_ring_publish_read()). */
+static __always_inline void
+spsc_ring_record_release(struct spsc_ring *restrict ring) {
+  spsc_ring_release(ring, ((const struct spsc_record *)(
+                               (unsigned char *)spsc_ring_buf(ring) +
+                               ring->pos_r_next))
+                              ->size);
+}
+
+/* SPSC ring device */
+
+/*
+ * Each open file of `/dev/x86linuxextra` (of the kernel module) has one SPSC
+ * ring shared with kernel code, created by SPSC_DEV_IOC_INIT with the data
+ * size; mmap() it with the size of PAGE_SIZE + PAGE_ALIGN(size) at offset 0.
+ *
+ * poll() (or the kernel side waiting) arms SPSC_RING_WAIT_DOORBELL, and the
+ * other side wakes it up after publishing (with SPSC_DEV_IOC_KICK from user
+ * space).
+ */
+#define SPSC_DEV_NAME "x86linuxextra"
+#define SPSC_DEV_SIZE_MAX (1u << 30)
+#define SPSC_DEV_IOC_INIT _IOW('x', 0x40, uint32_t)
+#define SPSC_DEV_IOC_KICK _IO('x', 0x41)
+
+/* SPMC broadcast ring */
+
+/*
+ * Broadcast ring (of a power-of-2 size) from one producer to the readers which
+ * can join and leave (up to SPMC_RING_READERS_MAX)
+ *
+ * Every reader sees the same bytes in place with its own cursor (on its own
+ * cache line), and the producer is gated by the slowest reader, which is
+ * re-calculated only when the ring looks full. The positions are free-running
+ * 64-bit sequences; Like `struct spsc_ring`, the data is at `offset`.
+ */
+#define SPMC_RING_READERS_MAX BITS_PER_BITSET
+struct spmc_reader {
+  uint64_t pos ____cacheline_aligned;
+  uint64_t pos_next; // Released but not yet published
+  uint64_t pos_w_cache;
+};
+struct spmc_ring {
+  /* Producer side */
+  uint64_t pos_w ____cacheline_aligned;
+  uint64_t pos_w_next; // Committed but not yet published
+  uint64_t gate;       // Cached position of the slowest reader
+  /* Read-only after init */
+  uint32_t mask ____cacheline_aligned;
+  uint32_t offset;
+  /* Readers (rarely written) */
+  bitset_t active ____cacheline_aligned; // Readers gating the producer
+  bitset_t claimed;                      // Readers joining (or joined)
+  struct spmc_reader readers[SPMC_RING_READERS_MAX];
+};
+
+/* `size` should be power of 2 (and at most 2^31). */
+void spmc_ring_init(struct spmc_ring *restrict ring, uint32_t offset,
+                    uint32_t size);
+static __always_inline void *spmc_ring_buf(const struct spmc_ring *ring) {
+  return (unsigned char *)ring + ring->offset;
+}
+
+/* Same as spsc_ring_reserve(). */
+void *spmc_ring_reserve(struct spmc_ring *restrict ring,
+                        uint32_t *restrict size);
+static __always_inline void spmc_ring_commit(struct spmc_ring *restrict ring,
+                                             uint32_t size) {
+  ring->pos_w_next += size;
+}
+static __always_inline void
+spmc_ring_publish_write(struct spmc_ring *restrict ring) {
+  __atomic_store_n(&ring->pos_w, ring->pos_w_next, __ATOMIC_RELEASE);
+}
+
+/* Return the reader ID starting from the latest position, or -1 if full. */
+int32_t spmc_ring_join(struct spmc_ring *restrict ring);
+void spmc_ring_leave(struct spmc_ring *restrict ring, uint32_t id);
+
+/* Same as spsc_ring_peek() with the reader ID. */
+const void *spmc_ring_peek(struct spmc_ring *restrict ring, uint32_t id,
+                           uint32_t *restrict size);
+static __always_inline void spmc_ring_release(struct spmc_ring *restrict ring,
+                                              uint32_t id, uint32_t size) {
+  (ring->readers + id)->pos_next += size;
+}
+static __always_inline void
+spmc_ring_publish_read(struct spmc_ring *restrict ring, uint32_t id) {
+  __atomic_store_n(&(ring->readers + id)->pos, (ring->readers + id)->pos_next,
+                   __ATOMIC_RELEASE);
+}
+
 /* x86 CPUID */
 
 static __always_inline void x86_cpuid(uint32_t *restrict eax,
@@ -260,6 +820,14 @@ static __always_inline void x86_cpuidex(uint32_t *restrict eax,
     *edx = __edx;
 }
 
+/* x86 XGETBV */
+
+static __always_inline uint64_t x86_xgetbv(uint32_t ecx) {
+  uint32_t __eax, __edx;
+  asm volatile("xgetbv" : "=a"(__eax), "=d"(__edx) : "c"(ecx));
+  return ((uint64_t)__edx << 32) | __eax;
+}
+
 /* [Common] END */
 
 #ifndef __KERNEL__
@@ -308,6 +876,47 @@ void log_init(const char *restrict ident, int option, int facility,
  */
 void log_deinit();
 
+/* What log*() does when the per-thread buffer is full in the async mode */
+#define LOG_ASYNC_DROP 0  // Drop the record (and count it).
+#define LOG_ASYNC_BLOCK 1 // Wait for the writer.
+/* Default (and minimum) size of the per-thread buffer */
+#define LOG_ASYNC_SIZE (256 * 1024)
+#define LOG_ASYNC_SIZE_MIN (8 * LOG_LINE_MAX)
+/*
+ * Start the async mode: log*() formats the record into the per-thread SPSC
+ * ring of `size` byte(s) (0 for LOG_ASYNC_SIZE), and the background thread
+ * writes them out in batch with writev() (or syslog()). The abort/backtrace
+ * paths flush the pending records first and stay synchronous, and the first
+ * start registers log_async_stop() with atexit() not to lose them on exit().
+ *
+ * Currently, it is not MT/AS-safe (with log*() either).
+ * Return 0 on success, or -1 with `errno` set.
+ */
+int log_async_start(uint32_t size, int policy);
+/*
+ * Write out the pending records and stop the background thread.
+ *
+ * Currently, it is not MT/AS-safe (with log*() either).
+ */
+void log_async_stop();
+/* Number of the records dropped by LOG_ASYNC_DROP */
+uint64_t log_async_dropped();
+
+/* Timestamp of the records */
+#define LOG_TIMESTAMP_NONE 0
+#define LOG_TIMESTAMP_ABS 1   // `[sec.nsec]` of the wall clock
+#define LOG_TIMESTAMP_DELTA 2 // `[+sec.nsec]` since the previous one of thread
+/*
+ * Stamp the records with TSC, converted to the wall clock with the frequency
+ * of usersched_init() (so call it first) from the current CLOCK_REALTIME;
+ * There is no clock_gettime() per record. This also applies to
+ * log_bin_decode().
+ *
+ * Currently, it is not MT/AS-safe (with log*() either).
+ * Return 0 on success, or -1 with `errno` set.
+ */
+int log_timestamp(int mode);
+
 #if !defined(LINE_MAX)
 #error !defined(LINE_MAX)
 #endif
@@ -340,6 +949,112 @@ void _vlog(int lvl, const char *restrict filename, int line,
 #define vtrace(lvl, fmt, ap)
 #endif
 
+/*
+ * Binary (deferred-formatting) logging
+ *
+ * log_bin() has the static descriptor of the format, file, line and level per
+ * call site, which is registered to the stream on the first call; After that,
+ * it only copies the descriptor ID, TSC and the raw arguments into the
+ * per-thread buffer of the async mode, which is written to the stream opened
+ * with log_bin_open() (decode it offline with log_bin_decode()).
+ *
+ * It falls back to log() unless both are active, if the format is not
+ * supported (positional arguments, `%n`, `%m` or wide strings), or if the
+ * entry exceeds the line (e.g., with a long string); The strings are read up
+ * to their precision as printf() does.
+ */
+#define LOG_BIN_ARGS_MAX 16
+#define LOG_BIN_ARG_INT 0         // 4 bytes
+#define LOG_BIN_ARG_LONG 1        // 8 bytes
+#define LOG_BIN_ARG_POINTER 2     // 8 bytes
+#define LOG_BIN_ARG_DOUBLE 3      // 8 bytes
+#define LOG_BIN_ARG_LONG_DOUBLE 4 // 16 bytes
+#define LOG_BIN_ARG_STRING 5      // 4-byte length (UINT32_MAX if NULL), data
+struct log_bin_desc {
+  const char *fmt, *filename, *func;
+  int lvl, line;
+  uint32_t id; // 0 until registered (LOG_BIN_ID_TEXT if not supported)
+  uint32_t nr_args;
+  uint8_t args[LOG_BIN_ARGS_MAX]; // LOG_BIN_ARG_*
+  uint32_t precs[LOG_BIN_ARGS_MAX]; // Precision of the strings (internal)
+  struct log_bin_desc *next;
+};
+#define LOG_BIN_ID_TEXT UINT32_MAX
+
+/*
+ * Stream format (in host byte order)
+ *
+ * Every record starts with `struct log_bin_record`: the stream header (which
+ * resets the descriptors), then the descriptors and the entries referring to
+ * the preceding ones (by the ID from 1).
+ */
+#define LOG_BIN_MAGIC "X86LBIN1"
+#define LOG_BIN_REC_DESC 0
+#define LOG_BIN_REC_STREAM UINT32_MAX
+struct log_bin_record {
+  uint32_t size; // Total size including this
+  uint32_t id;   // LOG_BIN_REC_* or descriptor ID
+};
+struct log_bin_stream {
+  struct log_bin_record hdr;
+  char magic[8];
+  uint64_t tsc_freq_hz;
+  uint64_t tsc_base, realtime_base; // TSC at `realtime_base` (in ns)
+  int32_t pid;
+  uint32_t reserved;
+  /* Identity with '\0' follows. */
+};
+struct log_bin_desc_record {
+  struct log_bin_record hdr;
+  uint32_t desc_id;
+  int32_t lvl, line;
+  uint32_t nr_args;
+  /* `args[nr_args]`, then format, file and function with '\0' follow. */
+};
+struct log_bin_entry {
+  struct log_bin_record hdr;
+  int32_t tid;
+  uint32_t reserved;
+  uint64_t tsc;
+  /* Arguments follow. */
+};
+
+/*
+ * Start the stream on `fd` (after writing the stream header and the registered
+ * descriptors), or stop it (without closing `fd`) after flushing the pending
+ * entries.
+ *
+ * Currently, it is not MT/AS-safe (with log*() either).
+ * Return 0 on success, or -1 with `errno` set.
+ */
+int log_bin_open(int fd);
+void log_bin_close();
+/*
+ * Write the stream from `fd` as the text (in the same format as log*() to
+ * `stderr`) to `out_fd` until EOF.
+ *
+ * Return 0 on success, or -1 with `errno` set (EBADMSG if malformed).
+ */
+int log_bin_decode(int fd, int out_fd);
+
+void _log_bin(struct log_bin_desc *restrict desc, const char *restrict file,
+              ...);
+#define log_bin(lvl, fmt, ...)                                                 \
+  ({                                                                           \
+    if (unlikely(log_lvl() >= lvl)) {                                          \
+      static struct log_bin_desc __log_bin_desc = {fmt, NULL, __func__, lvl, \
+                                                    __LINE__};                 \
+      if (0) /* Check the format only. */                                      \
+        _log(lvl, NULL, 0, NULL, fmt, ##__VA_ARGS__);                          \
+      _log_bin(&__log_bin_desc, __filename__, ##__VA_ARGS__);                  \
+    }                                                                          \
+  })
+#ifndef NDEBUG
+#define trace_bin(lvl, fmt, ...) log_bin(lvl, fmt, ##__VA_ARGS__)
+#else
+#define trace_bin(lvl, fmt, ...)
+#endif
+
 void _log_backtrace(int lvl, const char *restrict filename, int line,
                     const char *restrict func, int skip_lock);
 #define log_backtrace(lvl)                                                     \
@@ -353,6 +1068,34 @@ void _log_backtrace(int lvl, const char *restrict filename, int line,
 #define trace_backtrace(lvl)
 #endif
 
+/*
+ * Raw PCs of the call stack, captured without symbolization (which is cheap
+ * enough for warning paths); Print it later (symbolized with the cache of the
+ * PCs), or print it raw as `module+offset` to symbolize offline (e.g., with
+ * `addr2line -f -e module offset`).
+ */
+#define LOG_BACKTRACE_DEPTH 64
+struct log_backtrace {
+  uint32_t nr;
+  uintptr_t pc[LOG_BACKTRACE_DEPTH];
+};
+/* Capture the caller's stack skipping `skip` frame(s); Return the depth. */
+uint32_t log_backtrace_capture(struct log_backtrace *restrict bt, int skip);
+void _log_backtrace_print(int lvl, const char *restrict filename, int line,
+                          const char *restrict func,
+                          const struct log_backtrace *restrict bt, int raw,
+                          int skip_lock);
+#define log_backtrace_print(lvl, bt)                                           \
+  ({                                                                           \
+    if (unlikely(log_lvl() >= lvl))                                            \
+      _log_backtrace_print(lvl, __filename__, __LINE__, __func__, bt, 0, 0);   \
+  })
+#define log_backtrace_print_raw(lvl, bt)                                       \
+  ({                                                                           \
+    if (unlikely(log_lvl() >= lvl))                                            \
+      _log_backtrace_print(lvl, __filename__, __LINE__, __func__, bt, 1, 0);   \
+  })
+
 #define log_call(lvl, ret_fmt, func, param_fmt, ...)                           \
   ({                                                                           \
     const typeof(func(__VA_ARGS__)) __log_ret = func(__VA_ARGS__);             \
@@ -464,12 +1207,245 @@ void _log_assert_perror_fail(const char *restrict filename, int line,
 #define trace_assert_error(expr)
 #endif
 
+/* Persistent bitset file */
+
+/* "X86LBSET" in little endian */
+#define BITSET_FILE_MAGIC 0x544553424C363858ull
+#define BITSET_FILE_VERSION 1
+/* The words start from the next page for the aligned access. */
+#define BITSET_FILE_HEADER_SIZE PAGE_SIZE
+
+struct bitset_file_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t header_size; // Offset of the words from the file beginning
+  uint64_t nr_bits;
+};
+/* The words follow `bitset_t` layout, so any bitset function works on it. */
+struct bitset_file {
+  struct bitset_file_header *restrict header;
+  bitset_t *restrict bitset;
+  uint64_t nr_bits;
+  size_t size; // Mapped size
+  int fd;
+};
+
+/*
+ * Map the bitset file of `path` with open(path, oflag, mode).
+ *
+ * If the file is empty, it is created with `nr_bits` zeroed bits (`oflag`
+ * should not be O_RDONLY). Otherwise, the header is validated and `nr_bits`
+ * should be either 0 or same as the stored one.
+ *
+ * Return 0 on success, or -1 with `errno` set.
+ */
+int bitset_file_open(struct bitset_file *restrict file,
+                     const char *restrict path, uint64_t nr_bits, int oflag,
+                     mode_t mode);
+/* msync() the whole mapping with MS_ASYNC (if `async`) or MS_SYNC. */
+int bitset_file_sync(const struct bitset_file *restrict file, int async);
+int bitset_file_close(struct bitset_file *restrict file);
+
+/* Mirrored SPSC ring */
+
+/* The ring is followed by the data mapped twice, so no access is split. */
+struct spsc_ring_mirror {
+  struct spsc_ring *ring;
+  size_t size; // Mapped size
+  int fd;      // memfd
+};
+
+/*
+ * Create the mirrored ring of `size` byte(s) (rounded up to PAGE_SIZE) on the
+ * new memfd.
+ *
+ * Return 0 on success, or -1 with `errno` set.
+ */
+int spsc_ring_mirror_open(struct spsc_ring_mirror *restrict mirror,
+                          uint32_t size);
+/*
+ * Attach the mirrored ring of `fd` (from spsc_ring_mirror_open() of another
+ * process); `fd` is owned by `mirror` even on failure.
+ */
+int spsc_ring_mirror_attach(struct spsc_ring_mirror *restrict mirror, int fd);
+/*
+ * Create (if empty) or attach the mirrored ring of the shared memory object
+ * `name` with shm_open(name, oflag, mode); The creator should use O_EXCL not
+ * to race with the initialization.
+ *
+ * `size` is ignored when attaching unless it is non-zero and different.
+ */
+int spsc_ring_shm_open(struct spsc_ring_mirror *restrict mirror,
+                       const char *restrict name, uint32_t size, int oflag,
+                       mode_t mode);
+int spsc_ring_mirror_close(struct spsc_ring_mirror *restrict mirror);
+
+/*
+ * Wait until `size` byte(s) are used (or free) in the ring (which can be in
+ * shared memory) with usersched, then with FUTEX_WAIT_BITSET on the opposite
+ * cursor after announcing the waiter until the absolute deadline
+ * `kernel_timeout` (CLOCK_MONOTONIC, or CLOCK_REALTIME with
+ * FUTEX_CLOCK_REALTIME in `flags`; NULL if indefinite).
+ *
+ * `flags` are same as usersched_lock() (use FUTEX_PRIVATE_FLAG only if both
+ * sides are in the same process).
+ *
+ * Return 0 on success, or -1 with `errno` set.
+ */
+int spsc_ring_wait_read(struct spsc_ring *restrict ring, uint32_t size,
+                        int flags, uint32_t user_timeout_tsc,
+                        const struct timespec *restrict kernel_timeout);
+int spsc_ring_wait_write(struct spsc_ring *restrict ring, uint32_t size,
+                         int flags, uint32_t user_timeout_tsc,
+                         const struct timespec *restrict kernel_timeout);
+/*
+ * spsc_ring_publish_*() with FUTEX_WAKE only if the opposite side sleeps
+ *
+ * This includes full memory barrier (so publish in batch).
+ */
+int spsc_ring_publish_write_wake(struct spsc_ring *restrict ring, int flags);
+int spsc_ring_publish_read_wake(struct spsc_ring *restrict ring, int flags);
+
+/*
+ * eventfd doorbell of the consumer (e.g., in the epoll set)
+ *
+ * The consumer arms the doorbell when the ring is found empty, and the producer
+ * signals the eventfd only on the first publish after that (so there is no
+ * system call while the consumer is busy).
+ */
+struct spsc_ring_doorbell {
+  struct spsc_ring *ring;
+  int fd; // eventfd (non-blocking)
+};
+
+/* Return 0 on success, or -1 with `errno` set. */
+int spsc_ring_doorbell_open(struct spsc_ring_doorbell *restrict doorbell,
+                            struct spsc_ring *restrict ring);
+/* Attach `fd` (from another process) which is owned by `doorbell`. */
+static __always_inline void
+spsc_ring_doorbell_attach(struct spsc_ring_doorbell *restrict doorbell,
+                          struct spsc_ring *restrict ring, int fd) {
+  doorbell->ring = ring;
+  doorbell->fd = fd;
+}
+int spsc_ring_doorbell_close(struct spsc_ring_doorbell *restrict doorbell);
+/*
+ * Drain the eventfd and arm the doorbell if the ring is empty.
+ *
+ * Return 0 if armed (wait for the eventfd), 1 if not empty (consume first), or
+ * -1 with `errno` set.
+ */
+int spsc_ring_doorbell_arm(struct spsc_ring_doorbell *restrict doorbell);
+/*
+ * spsc_ring_publish_write() with signaling the eventfd only if armed
+ *
+ * This includes full memory barrier (so publish in batch).
+ */
+int spsc_ring_publish_write_doorbell(
+    struct spsc_ring_doorbell *restrict doorbell);
+
+/*
+ * Create the ring of `size` byte(s) on the new file of the kernel module device
+ * (`mirror` is not mirrored; close it with spsc_ring_mirror_close()).
+ *
+ * Return 0 on success, or -1 with `errno` set.
+ */
+int spsc_ring_dev_open(struct spsc_ring_mirror *restrict mirror,
+                       uint32_t size);
+/*
+ * spsc_ring_publish_*() with SPSC_DEV_IOC_KICK only if the doorbell is armed
+ *
+ * This includes full memory barrier (so publish in batch).
+ */
+int spsc_ring_dev_publish_write(struct spsc_ring_mirror *restrict mirror);
+int spsc_ring_dev_publish_read(struct spsc_ring_mirror *restrict mirror);
+
+/* Compressed bitset (Roaring-style) */
+
+/* 32-bit indices are split into 16-bit key of the chunk and 16-bit offset. */
+#define CBITSET_CHUNK_BITS 65536
+/* Chunks with more set bits use the bitmap container. */
+#define CBITSET_ARRAY_MAX 4096
+
+enum cbitset_type {
+  CBITSET_ARRAY,  // Sorted offsets
+  CBITSET_BITMAP, // `bitset_t` of CBITSET_CHUNK_BITS
+  CBITSET_RUN,    // Sorted runs (only made by cbitset_optimize())
+};
+struct cbitset_run {
+  uint16_t start;
+  uint16_t len; // Length - 1
+};
+struct cbitset_container {
+  union {
+    uint16_t *array;
+    bitset_t *bitmap;
+    struct cbitset_run *runs;
+  };
+  uint32_t card; // Number of set bits
+  uint32_t nr;   // Number of offsets or runs
+  uint32_t cap;
+  uint16_t key;
+  uint8_t type;
+};
+/* Containers are sorted by the key and never empty. */
+struct cbitset {
+  struct cbitset_container *containers;
+  uint32_t nr;
+  uint32_t cap;
+};
+
+void cbitset_init(struct cbitset *restrict cb);
+void cbitset_deinit(struct cbitset *restrict cb);
+int cbitset_test(const struct cbitset *restrict cb, uint32_t idx);
+/* Return the old bit, or -1 with `errno` set. */
+int cbitset_set(struct cbitset *restrict cb, uint32_t idx);
+/* Return the old bit, or -1 with `errno` set. */
+int cbitset_unset(struct cbitset *restrict cb, uint32_t idx);
+uint64_t cbitset_count(const struct cbitset *restrict cb);
+/* Return the size (in byte(s)) of the allocated memory. */
+size_t cbitset_size(const struct cbitset *restrict cb);
+/* Return the lowest set bit from `start_idx`, or -1 if there is no one. */
+int64_t cbitset_search_lowest(const struct cbitset *restrict cb,
+                              uint32_t start_idx);
+/* Store up to `nr` set bits from `start_idx` to `idxs`; Return the count. */
+uint32_t cbitset_extract(const struct cbitset *restrict cb, uint32_t start_idx,
+                         uint32_t *restrict idxs, uint32_t nr);
+/*
+ * dest = a & b and dest = a | b (`dest` should be initialized and differ from
+ * the others); Return 0 on success, or -1 with `errno` set (`dest` is empty).
+ */
+int cbitset_and(struct cbitset *restrict dest, const struct cbitset *a,
+                const struct cbitset *b);
+int cbitset_or(struct cbitset *restrict dest, const struct cbitset *a,
+               const struct cbitset *b);
+/* Convert containers to the run ones where it saves memory. */
+int cbitset_optimize(struct cbitset *restrict cb);
+
+/* x86 ISA extensions */
+
+/*
+ * Boolean of AVX2 support (including the OS support of YMM state) on this
+ * system set at load time
+ */
+extern int x86_support_avx2;
+/*
+ * Boolean of AVX-512 (F/BW/VL) support (including the OS support of ZMM state)
+ * on this system set at load time
+ */
+extern int x86_support_avx512;
+
 /* x86 UMWAIT/TPAUSE */
 
+/*
+ * Wait while `*uaddr32_wb` equals `oldval32` (monitor it, then check again not
+ * to miss the store before UMWAIT); Return the carry flag of UMWAIT, or 0 if
+ * the value has already changed.
+ */
 static __always_inline unsigned char
 X86_UMWAIT(const volatile uint32_t *restrict uaddr32_wb, uint32_t oldval32,
            uint32_t control, uint64_t tsc) {
-  if (*uaddr32_wb == oldval32)
+  if (*uaddr32_wb != oldval32)
     return 0;
   _umonitor((void *)uaddr32_wb);
   return *uaddr32_wb == oldval32 ? _umwait(control, tsc) : 0;
@@ -687,19 +1663,130 @@ int usersched_plock_pi2(volatile uint32_t *restrict lock, pid_t tid, int flags,
 int usersched_punlock_pi(volatile uint32_t *restrict lock, pid_t tid, int flags,
                          const sigset_t *restrict set);
 
-/* DO NOT USE THIS AS IT IS NOT OPTIMIZED! */
+/* Watched word of usersched_poll() */
+struct usersched_watch {
+  const volatile uint32_t *uaddr32;
+  uint32_t oldval32;
+};
+#define USERSCHED_POLL_MAX FUTEX_WAITV_MAX
+/*
+ * Wait until any of `nr` (up to USERSCHED_POLL_MAX) words differs from its old
+ * value; Scan them with usersched (PAUSE), then sleep on all of them at once
+ * with futex_waitv() until the deadline `abs_timeout` (CLOCK_MONOTONIC, or
+ * CLOCK_REALTIME with FUTEX_CLOCK_REALTIME in `flags`; NULL if indefinite).
+ *
+ * The bits of the changed ones are stored to `changed` (BITSET_LEN(nr) long).
+ * `flags` are same as usersched_lock() (USERSCHED_NOEAGAIN is ignored).
+ *
+ * Return the number of the changed ones, or -1 with `errno` set (ETIMEDOUT if
+ * the deadline passed).
+ */
+int usersched_poll(const struct usersched_watch *restrict watches, uint32_t nr,
+                   bitset_t *restrict changed, int flags,
+                   uint32_t user_timeout_tsc,
+                   const struct timespec *restrict abs_timeout);
+
+/* DO NOT USE THIS AS IT IS NOT OPTIMIZED! (use spsc_ring_peek_wait()) */
 uint32_t usersched_spsc_prepare_read(uint32_t *restrict pos_r,
                                      const volatile uint32_t *restrict pos_w,
                                      uint32_t pos_end, uint32_t size,
                                      uint32_t *restrict usersched_tsc,
                                      uint32_t *restrict pos_w_save);
-/* DO NOT USE THIS AS IT IS NOT OPTIMIZED! */
+/* DO NOT USE THIS AS IT IS NOT OPTIMIZED! (use spsc_ring_reserve_wait()) */
 uint32_t usersched_spsc_prepare_write(const volatile uint32_t *restrict pos_r,
                                       uint32_t *restrict pos_w,
                                       uint32_t pos_end, uint32_t size,
                                       uint32_t *restrict usersched_tsc,
                                       uint32_t *restrict pos_r_save);
 
+/*
+ * Blocking spsc_ring_peek() (or spsc_ring_reserve()) returning up to `*size`
+ * byte(s) once the ring is not empty (or full)
+ *
+ * It spins with PAUSE for `spin_tsc`, then UMWAITs (if supported) on the
+ * opposite cursor for `umwait_tsc`, and then sleeps on the futex; All stages
+ * share the one absolute deadline `abs_timeout` (CLOCK_MONOTONIC, or
+ * CLOCK_REALTIME with FUTEX_CLOCK_REALTIME in `flags`; NULL if indefinite).
+ * The pending releases (or commits) are published before waiting.
+ *
+ * `flags` are same as usersched_lock() (USERSCHED_* are ignored).
+ *
+ * Return NULL with `errno` set on failure (ETIMEDOUT if the deadline passed).
+ */
+const void *spsc_ring_peek_wait(struct spsc_ring *restrict ring,
+                                uint32_t *restrict size, int flags,
+                                uint32_t spin_tsc, uint32_t umwait_tsc,
+                                const struct timespec *restrict abs_timeout);
+void *spsc_ring_reserve_wait(struct spsc_ring *restrict ring,
+                             uint32_t *restrict size, int flags,
+                             uint32_t spin_tsc, uint32_t umwait_tsc,
+                             const struct timespec *restrict abs_timeout);
+
+/* MPMC queue */
+
+/*
+ * Bounded lock-free MPMC queue of fixed-size elements (Vyukov-style)
+ *
+ * Each slot has the sequence telling which round (and side) owns it, so the
+ * producers and the consumers only contend on their own cursor. Like
+ * `struct spsc_ring`, the slots follow the queue itself.
+ */
+struct mpmc_slot {
+  uint64_t seq;
+  unsigned char elem[];
+};
+#define MPMC_SLOT_SIZE(elem_size)                                              \
+  align_val_pow2(sizeof(struct mpmc_slot) + (elem_size), sizeof(uint64_t))
+struct mpmc_queue {
+  uint64_t pos_enq ____cacheline_aligned;
+  uint64_t pos_deq ____cacheline_aligned;
+  /* Read-only after init */
+  uint32_t mask ____cacheline_aligned;
+  uint32_t elem_size;
+  uint32_t slot_size;
+  uint32_t offset;
+  /* Sleeping producers (futex) */
+  uint32_t enq_event ____cacheline_aligned;
+  uint32_t enq_waiters;
+  /* Sleeping consumers (futex) */
+  uint32_t deq_event ____cacheline_aligned;
+  uint32_t deq_waiters;
+};
+
+/* Return the size (in byte(s)) of memory for the queue and its slots. */
+size_t mpmc_queue_size(uint32_t nr_slots, uint32_t elem_size);
+/* `nr_slots` should be power of 2; Return 0, or -1 with `errno` set. */
+int mpmc_queue_init(struct mpmc_queue *restrict queue, uint32_t nr_slots,
+                    uint32_t elem_size);
+
+/*
+ * Return 0, or -1 with `errno` (EAGAIN if full or empty) set.
+ *
+ * `flags` are same as usersched_lock() (for waking up the sleeping ones).
+ */
+int mpmc_try_enqueue(struct mpmc_queue *restrict queue,
+                     const void *restrict elem, int flags);
+int mpmc_try_dequeue(struct mpmc_queue *restrict queue, void *restrict elem,
+                     int flags);
+/* Return the number of enqueued (or dequeued) elements (without blocking). */
+uint32_t mpmc_enqueue_batch(struct mpmc_queue *restrict queue,
+                            const void *restrict elems, uint32_t nr,
+                            int flags);
+uint32_t mpmc_dequeue_batch(struct mpmc_queue *restrict queue,
+                            void *restrict elems, uint32_t nr, int flags);
+/*
+ * Blocking variants: Same as usersched_lock() (usersched snooping the slot,
+ * then FUTEX_WAIT_BITSET on the queue until the absolute deadline
+ * `kernel_timeout` (CLOCK_MONOTONIC, or CLOCK_REALTIME with
+ * FUTEX_CLOCK_REALTIME in `flags`; NULL if indefinite))
+ */
+int mpmc_enqueue(struct mpmc_queue *restrict queue, const void *restrict elem,
+                 int flags, uint32_t user_timeout_tsc,
+                 const struct timespec *restrict kernel_timeout);
+int mpmc_dequeue(struct mpmc_queue *restrict queue, void *restrict elem,
+                 int flags, uint32_t user_timeout_tsc,
+                 const struct timespec *restrict kernel_timeout);
+
 /* [Userspace] END */
 
 #else
@@ -808,6 +1895,43 @@ typedef u64 uint64_t;
 #define trace_pci(pdev, lvl, fmt, ...)
 #endif
 
+/* SPSC ring device */
+
+struct spsc_dev;
+
+int spsc_dev_register(void);
+void spsc_dev_unregister(void);
+
+/*
+ * Get the initialized device of `fd` (e.g., passed by ioctl() of the driver),
+ * or ERR_PTR() on failure; The reference should be put by spsc_dev_put().
+ */
+struct spsc_dev *spsc_dev_get(int fd);
+void spsc_dev_put(struct spsc_dev *dev);
+
+/*
+ * Same as spsc_ring_*() but with the geometry and the cursors kept by the
+ * kernel (user space can write the mapped header); The data is still writable
+ * by user space while it is peeked.
+ */
+void *spsc_dev_reserve(struct spsc_dev *dev, uint32_t *size);
+void spsc_dev_commit(struct spsc_dev *dev, uint32_t size);
+const void *spsc_dev_peek(struct spsc_dev *dev, uint32_t *size);
+void spsc_dev_release(struct spsc_dev *dev, uint32_t size);
+uint32_t spsc_dev_write(struct spsc_dev *dev, const void *src, uint32_t size);
+uint32_t spsc_dev_read(struct spsc_dev *dev, void *dest, uint32_t size);
+
+/* spsc_ring_publish_*() with waking up the other side (if armed) */
+void spsc_dev_publish_write(struct spsc_dev *dev);
+void spsc_dev_publish_read(struct spsc_dev *dev);
+
+/*
+ * Wait (interruptibly) until `size` byte(s) are used (or free) in the ring;
+ * Return -EIO if user space stored an invalid cursor.
+ */
+int spsc_dev_wait_read(struct spsc_dev *dev, uint32_t size);
+int spsc_dev_wait_write(struct spsc_dev *dev, uint32_t size);
+
 #endif
 
 /* [Kernel] END */
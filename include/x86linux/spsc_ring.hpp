@@ -0,0 +1,169 @@
+#pragma once
+
+/* Do not expand has_single_bit() of helper.h (if included) in <bit>. */
+#pragma push_macro("has_single_bit")
+#undef has_single_bit
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+#pragma pop_macro("has_single_bit")
+
+#include "x86linux/helper.h"
+
+namespace x86linux {
+
+/*
+ * Typed SPSC ring of `N` slots (up to `N - 1` elements) on the same layout as
+ * `struct spsc_ring` (so it can be shared with the C API reserving and peeking
+ * exactly `sizeof(T)` byte(s) per element)
+ *
+ * The size is known at compile time, so the positions are masked (instead of
+ * compared) if `N * sizeof(T)` is power of 2. Elements are constructed in place
+ * and destroyed when popped. (qualify it with the namespace not to be confused
+ * with `struct spsc_ring`)
+ */
+template <typename T, uint32_t N> struct spsc_ring {
+  static_assert(N >= 2, "N should be 2 or more.");
+  static_assert((uint64_t)N * sizeof(T) <= INT32_MAX, "Too large");
+
+  struct ::spsc_ring ring;
+  alignas(T) alignas(L1_CACHE_BYTES) unsigned char data[N * sizeof(T)];
+
+  spsc_ring() { spsc_ring_init(&ring, offsetof(spsc_ring, data), _size); }
+  ~spsc_ring() {
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      const uint32_t __pos_w = __atomic_load_n(&ring.pos_w, __ATOMIC_ACQUIRE);
+      for (uint32_t __pos = ring.pos_r_next; __pos != __pos_w;
+           __pos = _next(__pos))
+        _elem(__pos)->~T();
+    }
+  }
+  spsc_ring(const spsc_ring &) = delete;
+  spsc_ring &operator=(const spsc_ring &) = delete;
+
+  /* Return the typed ring of `ring` (from the C API), or nullptr if unfit. */
+  static spsc_ring *attach(struct ::spsc_ring *ring) {
+    if (ring->size != _size || ring->offset != offsetof(spsc_ring, data))
+      return nullptr;
+    return reinterpret_cast<spsc_ring *>(ring);
+  }
+
+  /* Producer side */
+
+  template <typename... Args> bool try_emplace(Args &&...args) {
+    const uint32_t __pos_w = ring.pos_w_next;
+    const uint32_t __next = _next(__pos_w);
+    if (__next == ring.pos_r_cache) {
+      /* Re-read the opposite cursor only when it looks full. */
+      ring.pos_r_cache = __atomic_load_n(&ring.pos_r, __ATOMIC_ACQUIRE);
+      if (__next == ring.pos_r_cache)
+        return false;
+    }
+    ::new (data + __pos_w) T(std::forward<Args>(args)...);
+    ring.pos_w_next = __next;
+    spsc_ring_publish_write(&ring);
+    return true;
+  }
+  bool try_push(const T &elem) { return try_emplace(elem); }
+  bool try_push(T &&elem) { return try_emplace(std::move(elem)); }
+
+  /* Copy (or move) as many as possible and publish them at once. */
+  uint32_t push(std::span<const T> elems) { return _push(elems); }
+  uint32_t push_move(std::span<T> elems) { return _push(elems); }
+
+  /* Consumer side */
+
+  bool try_pop(T &elem) {
+    const uint32_t __pos_r = ring.pos_r_next;
+    if (__pos_r == ring.pos_w_cache) {
+      /* Re-read the opposite cursor only when it looks empty. */
+      ring.pos_w_cache = __atomic_load_n(&ring.pos_w, __ATOMIC_ACQUIRE);
+      if (__pos_r == ring.pos_w_cache)
+        return false;
+    }
+    T *const __elem = _elem(__pos_r);
+    elem = std::move(*__elem);
+    __elem->~T();
+    ring.pos_r_next = _next(__pos_r);
+    spsc_ring_publish_read(&ring);
+    return true;
+  }
+
+  /* Move as many as possible to `elems` and publish them at once. */
+  uint32_t pop(std::span<T> elems) {
+    uint32_t __pos_r = ring.pos_r_next;
+    uint32_t __nr = _used(__pos_r, ring.pos_w_cache);
+    if (__nr < elems.size()) {
+      ring.pos_w_cache = __atomic_load_n(&ring.pos_w, __ATOMIC_ACQUIRE);
+      __nr = _used(__pos_r, ring.pos_w_cache);
+    }
+    if (__nr > elems.size())
+      __nr = elems.size();
+    for (uint32_t __i = 0; __i < __nr; ++__i) {
+      T *const __elem = _elem(__pos_r);
+      elems[__i] = std::move(*__elem);
+      __elem->~T();
+      __pos_r = _next(__pos_r);
+    }
+    if (likely(__nr)) {
+      ring.pos_r_next = __pos_r;
+      spsc_ring_publish_read(&ring);
+    }
+    return __nr;
+  }
+
+  bool empty() const {
+    return ring.pos_r_next == __atomic_load_n(&ring.pos_w, __ATOMIC_ACQUIRE);
+  }
+
+private:
+  static constexpr uint32_t _size = N * sizeof(T);
+
+  T *_elem(uint32_t pos) {
+    return std::launder(reinterpret_cast<T *>(data + pos));
+  }
+  static constexpr uint32_t _next(uint32_t pos) {
+    pos += sizeof(T);
+    if constexpr (has_single_bit(_size))
+      return pos & (_size - 1);
+    else
+      return pos == _size ? 0 : pos;
+  }
+  /* Number of free (or used) elements */
+  static constexpr uint32_t _free(uint32_t pos_r, uint32_t pos_w) {
+    return (pos_r > pos_w ? pos_r - pos_w - 1 : _size - pos_w + pos_r - 1) /
+           sizeof(T);
+  }
+  static constexpr uint32_t _used(uint32_t pos_r, uint32_t pos_w) {
+    return (pos_w >= pos_r ? pos_w - pos_r : _size - pos_r + pos_w) /
+           sizeof(T);
+  }
+
+  template <typename U> uint32_t _push(std::span<U> elems) {
+    uint32_t __pos_w = ring.pos_w_next;
+    uint32_t __nr = _free(ring.pos_r_cache, __pos_w);
+    if (__nr < elems.size()) {
+      ring.pos_r_cache = __atomic_load_n(&ring.pos_r, __ATOMIC_ACQUIRE);
+      __nr = _free(ring.pos_r_cache, __pos_w);
+    }
+    if (__nr > elems.size())
+      __nr = elems.size();
+    for (uint32_t __i = 0; __i < __nr; ++__i) {
+      if constexpr (std::is_const_v<U>)
+        ::new (data + __pos_w) T(elems[__i]);
+      else
+        ::new (data + __pos_w) T(std::move(elems[__i]));
+      __pos_w = _next(__pos_w);
+    }
+    if (likely(__nr)) {
+      ring.pos_w_next = __pos_w;
+      spsc_ring_publish_write(&ring);
+    }
+    return __nr;
+  }
+};
+
+} // namespace x86linux
@@ -2,9 +2,9 @@
 
 MODULE_LICENSE("Dual BSD/GPL");
 
-static int x86linuxextra_init(void) { return 0; }
+static int x86linuxextra_init(void) { return spsc_dev_register(); }
 module_init(x86linuxextra_init);
-static void x86linuxextra_exit(void) {}
+static void x86linuxextra_exit(void) { spsc_dev_unregister(); }
 module_exit(x86linuxextra_exit);
 
 /* Bitset operations */
@@ -12,8 +12,51 @@ module_exit(x86linuxextra_exit);
 EXPORT_SYMBOL(bitset_test);
 EXPORT_SYMBOL(bitset_set);
 EXPORT_SYMBOL(bitset_unset);
+EXPORT_SYMBOL(bitset_test64);
+EXPORT_SYMBOL(bitset_set64);
+EXPORT_SYMBOL(bitset_unset64);
 EXPORT_SYMBOL(bitset_search_lowest);
 EXPORT_SYMBOL(bitset_search_lowest_common);
+EXPORT_SYMBOL(bitset_search_lowest_common_n);
+EXPORT_SYMBOL(bitset_search_lowest_zero);
+EXPORT_SYMBOL(bitset_search_highest);
+EXPORT_SYMBOL(bitset_extract);
+EXPORT_SYMBOL(bitset_search_lowest64);
+EXPORT_SYMBOL(bitset_search_lowest_common64);
+EXPORT_SYMBOL(bitset_search_lowest_zero64);
+EXPORT_SYMBOL(bitset_search_highest64);
+EXPORT_SYMBOL(bitset_extract64);
+EXPORT_SYMBOL(bitset_and);
+EXPORT_SYMBOL(bitset_or);
+EXPORT_SYMBOL(bitset_xor);
+EXPORT_SYMBOL(bitset_andnot);
+EXPORT_SYMBOL(bitset_and64);
+EXPORT_SYMBOL(bitset_or64);
+EXPORT_SYMBOL(bitset_xor64);
+EXPORT_SYMBOL(bitset_andnot64);
+EXPORT_SYMBOL(bitset_set_range);
+EXPORT_SYMBOL(bitset_unset_range);
+EXPORT_SYMBOL(bitset_count);
+EXPORT_SYMBOL(bitset_set_range64);
+EXPORT_SYMBOL(bitset_unset_range64);
+EXPORT_SYMBOL(bitset_count64);
+EXPORT_SYMBOL(bitset_hier_size);
+EXPORT_SYMBOL(bitset_hier_init);
+EXPORT_SYMBOL(bitset_hier_set);
+EXPORT_SYMBOL(bitset_hier_unset);
+EXPORT_SYMBOL(bitset_hier_set_atomic);
+EXPORT_SYMBOL(bitset_hier_unset_atomic);
+EXPORT_SYMBOL(bitset_hier_search_lowest);
+EXPORT_SYMBOL(bitset_idalloc_init);
+EXPORT_SYMBOL(bitset_idalloc_get);
+EXPORT_SYMBOL(bitset_idalloc_put);
+EXPORT_SYMBOL(bitset_idalloc_get_batch);
+EXPORT_SYMBOL(bitset_idalloc_put_batch);
+
+/* memvcmp() */
+
+EXPORT_SYMBOL(memvspn);
+EXPORT_SYMBOL(memvcmp_pages);
 
 /* Logger */
 
@@ -27,3 +70,33 @@ EXPORT_SYMBOL(spsc_read);
 EXPORT_SYMBOL(spsc_write);
 EXPORT_SYMBOL(spsc_rewind_read);
 EXPORT_SYMBOL(spsc_rewind_write);
+EXPORT_SYMBOL(spsc_ring_init);
+EXPORT_SYMBOL(spsc_ring_write);
+EXPORT_SYMBOL(spsc_ring_read);
+EXPORT_SYMBOL(spsc_ring_reserve);
+EXPORT_SYMBOL(spsc_ring_peek);
+EXPORT_SYMBOL(spsc_ring_record_reserve);
+EXPORT_SYMBOL(spsc_ring_record_peek);
+
+/* SPSC ring device */
+
+EXPORT_SYMBOL(spsc_dev_get);
+EXPORT_SYMBOL(spsc_dev_put);
+EXPORT_SYMBOL(spsc_dev_reserve);
+EXPORT_SYMBOL(spsc_dev_commit);
+EXPORT_SYMBOL(spsc_dev_peek);
+EXPORT_SYMBOL(spsc_dev_release);
+EXPORT_SYMBOL(spsc_dev_write);
+EXPORT_SYMBOL(spsc_dev_read);
+EXPORT_SYMBOL(spsc_dev_publish_write);
+EXPORT_SYMBOL(spsc_dev_publish_read);
+EXPORT_SYMBOL(spsc_dev_wait_read);
+EXPORT_SYMBOL(spsc_dev_wait_write);
+
+/* SPMC broadcast ring */
+
+EXPORT_SYMBOL(spmc_ring_init);
+EXPORT_SYMBOL(spmc_ring_reserve);
+EXPORT_SYMBOL(spmc_ring_join);
+EXPORT_SYMBOL(spmc_ring_leave);
+EXPORT_SYMBOL(spmc_ring_peek);
@@ -0,0 +1,289 @@
+#include "x86linux/helper.h"
+
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+
+/*
+ * The header page is writable by user space, so the kernel never reads back
+ * the geometry or its own cursors from it; Only the cursor of the other side
+ * is loaded from it (and checked).
+ */
+struct spsc_dev {
+  struct file *file;
+  struct spsc_ring *ring; // vmalloc_user() (NULL until SPSC_DEV_IOC_INIT)
+  unsigned char *buf;     // Data of `ring_size` byte(s)
+  uint32_t ring_size;
+  /* Kernel cursors (the published ones are only stored to `ring`) */
+  uint32_t pos_w_next, pos_r_cache;
+  uint32_t pos_r_next, pos_w_cache;
+  int corrupted; // User space stored an invalid cursor.
+  size_t size;   // Mapped size
+  wait_queue_head_t wq;
+  struct mutex lock; // Serialize the initialization
+};
+
+static __always_inline uint32_t _spsc_dev_used(uint32_t pos_r, uint32_t pos_w,
+                                               uint32_t size) {
+  return pos_w >= pos_r ? pos_w - pos_r : size - pos_r + pos_w;
+}
+static __always_inline uint32_t _spsc_dev_free(uint32_t pos_r, uint32_t pos_w,
+                                               uint32_t size) {
+  return size - 1 - _spsc_dev_used(pos_r, pos_w, size);
+}
+/* Load the cursor of user space into `*cache` (kept if out of the ring). */
+static __always_inline void _spsc_dev_load(struct spsc_dev *dev,
+                                           const uint32_t *pos,
+                                           uint32_t *cache) {
+  const uint32_t __pos = smp_load_acquire(pos);
+  if (unlikely(__pos >= dev->ring_size))
+    WRITE_ONCE(dev->corrupted, 1);
+  else
+    *cache = __pos;
+}
+
+/* Arm the doorbell (full barrier) before checking the condition. */
+static __always_inline void _spsc_dev_arm(struct spsc_ring *ring) {
+  __atomic_or_fetch(&ring->waiters, SPSC_RING_WAIT_DOORBELL, __ATOMIC_SEQ_CST);
+}
+/* Wake up the other side sleeping on the device (if armed). */
+static void _spsc_dev_wake(struct spsc_dev *dev) {
+  struct spsc_ring *const __ring = dev->ring;
+
+  /* Pair with the arming. */
+  smp_mb();
+  if (likely(!(READ_ONCE(__ring->waiters) & SPSC_RING_WAIT_DOORBELL)))
+    return;
+  __atomic_and_fetch(&__ring->waiters, ~SPSC_RING_WAIT_DOORBELL,
+                     __ATOMIC_RELAXED);
+  wake_up_interruptible_all(&dev->wq);
+}
+
+static int _spsc_dev_open(struct inode *inode, struct file *file) {
+  struct spsc_dev *const __dev = kzalloc(sizeof(*__dev), GFP_KERNEL);
+  if (!__dev)
+    return -ENOMEM;
+  __dev->file = file;
+  init_waitqueue_head(&__dev->wq);
+  mutex_init(&__dev->lock);
+  file->private_data = __dev;
+  return 0;
+}
+static int _spsc_dev_release(struct inode *inode, struct file *file) {
+  struct spsc_dev *const __dev = file->private_data;
+  vfree(__dev->ring);
+  kfree(__dev);
+  return 0;
+}
+
+static long _spsc_dev_init(struct spsc_dev *dev, uint32_t __user *arg) {
+  uint32_t __size;
+  if (get_user(__size, arg))
+    return -EFAULT;
+  if (!__size || __size > SPSC_DEV_SIZE_MAX)
+    return -EINVAL;
+
+  struct spsc_ring *__ring = NULL;
+  long __ret = 0;
+  mutex_lock(&dev->lock);
+  if (dev->ring)
+    __ret = -EBUSY;
+  else if (!(__ring = vmalloc_user(PAGE_SIZE + PAGE_ALIGN(__size))))
+    __ret = -ENOMEM;
+  else {
+    spsc_ring_init(__ring, PAGE_SIZE, __size);
+    dev->buf = (unsigned char *)__ring + PAGE_SIZE;
+    dev->ring_size = __size;
+    dev->size = PAGE_SIZE + PAGE_ALIGN(__size);
+    smp_store_release(&dev->ring, __ring); // Publish it with the geometry.
+  }
+  mutex_unlock(&dev->lock);
+  return __ret;
+}
+static long _spsc_dev_ioctl(struct file *file, unsigned int cmd,
+                            unsigned long arg) {
+  struct spsc_dev *const __dev = file->private_data;
+
+  switch (cmd) {
+  case SPSC_DEV_IOC_INIT:
+    return _spsc_dev_init(__dev, (uint32_t __user *)arg);
+  case SPSC_DEV_IOC_KICK:
+    if (!smp_load_acquire(&__dev->ring))
+      return -ENODEV;
+    __atomic_and_fetch(&__dev->ring->waiters, ~SPSC_RING_WAIT_DOORBELL,
+                       __ATOMIC_RELAXED);
+    wake_up_interruptible_all(&__dev->wq);
+    return 0;
+  }
+  return -ENOTTY;
+}
+
+static int _spsc_dev_mmap(struct file *file, struct vm_area_struct *vma) {
+  struct spsc_dev *const __dev = file->private_data;
+  struct spsc_ring *const __ring = smp_load_acquire(&__dev->ring);
+  if (!__ring)
+    return -ENODEV;
+  if (vma->vm_pgoff || vma->vm_end - vma->vm_start != __dev->size)
+    return -EINVAL;
+  return remap_vmalloc_range(vma, __ring, 0);
+}
+
+static __poll_t _spsc_dev_poll(struct file *file, poll_table *wait) {
+  struct spsc_dev *const __dev = file->private_data;
+  struct spsc_ring *const __ring = smp_load_acquire(&__dev->ring);
+  if (!__ring)
+    return EPOLLERR;
+
+  poll_wait(file, &__dev->wq, wait);
+  _spsc_dev_arm(__ring);
+
+  const uint32_t __pos_r = smp_load_acquire(&__ring->pos_r);
+  const uint32_t __pos_w = smp_load_acquire(&__ring->pos_w);
+  if (unlikely(__pos_r >= __dev->ring_size || __pos_w >= __dev->ring_size))
+    return EPOLLERR;
+  const uint32_t __used = _spsc_dev_used(__pos_r, __pos_w, __dev->ring_size);
+  __poll_t __mask = 0;
+  if (__used)
+    __mask |= EPOLLIN | EPOLLRDNORM;
+  if (__used < __dev->ring_size - 1)
+    __mask |= EPOLLOUT | EPOLLWRNORM;
+  return __mask;
+}
+
+static const struct file_operations _spsc_dev_fops = {
+    .owner = THIS_MODULE,
+    .open = _spsc_dev_open,
+    .release = _spsc_dev_release,
+    .unlocked_ioctl = _spsc_dev_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+    .mmap = _spsc_dev_mmap,
+    .poll = _spsc_dev_poll,
+    .llseek = noop_llseek,
+};
+static struct miscdevice _spsc_dev_misc = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = SPSC_DEV_NAME,
+    .fops = &_spsc_dev_fops,
+};
+
+int spsc_dev_register(void) { return misc_register(&_spsc_dev_misc); }
+void spsc_dev_unregister(void) { misc_deregister(&_spsc_dev_misc); }
+
+struct spsc_dev *spsc_dev_get(int fd) {
+  struct file *const __file = fget(fd);
+  if (!__file)
+    return ERR_PTR(-EBADF);
+  if (__file->f_op != &_spsc_dev_fops) {
+    fput(__file);
+    return ERR_PTR(-EINVAL);
+  }
+
+  struct spsc_dev *const __dev = __file->private_data;
+  if (!smp_load_acquire(&__dev->ring)) {
+    fput(__file);
+    return ERR_PTR(-ENODEV);
+  }
+  return __dev;
+}
+void spsc_dev_put(struct spsc_dev *dev) { fput(dev->file); }
+
+void *spsc_dev_reserve(struct spsc_dev *dev, uint32_t *size) {
+  const uint32_t __pos_w = dev->pos_w_next;
+
+  uint32_t __free = _spsc_dev_free(dev->pos_r_cache, __pos_w, dev->ring_size);
+  if (__free < *size) {
+    _spsc_dev_load(dev, &dev->ring->pos_r, &dev->pos_r_cache);
+    __free = _spsc_dev_free(dev->pos_r_cache, __pos_w, dev->ring_size);
+  }
+  *size = min3(*size, __free, dev->ring_size - __pos_w);
+  return likely(*size) ? dev->buf + __pos_w : NULL;
+}
+void spsc_dev_commit(struct spsc_dev *dev, uint32_t size) {
+  dev->pos_w_next += size;
+  if (dev->pos_w_next >= dev->ring_size)
+    dev->pos_w_next -= dev->ring_size;
+}
+const void *spsc_dev_peek(struct spsc_dev *dev, uint32_t *size) {
+  const uint32_t __pos_r = dev->pos_r_next;
+
+  uint32_t __used = _spsc_dev_used(__pos_r, dev->pos_w_cache, dev->ring_size);
+  if (__used < *size) {
+    _spsc_dev_load(dev, &dev->ring->pos_w, &dev->pos_w_cache);
+    __used = _spsc_dev_used(__pos_r, dev->pos_w_cache, dev->ring_size);
+  }
+  *size = min3(*size, __used, dev->ring_size - __pos_r);
+  return likely(*size) ? dev->buf + __pos_r : NULL;
+}
+void spsc_dev_release(struct spsc_dev *dev, uint32_t size) {
+  dev->pos_r_next += size;
+  if (dev->pos_r_next >= dev->ring_size)
+    dev->pos_r_next -= dev->ring_size;
+}
+
+uint32_t spsc_dev_write(struct spsc_dev *dev, const void *src, uint32_t size) {
+  uint32_t __done = 0;
+  while (__done < size) {
+    uint32_t __size = size - __done;
+    void *const __ptr = spsc_dev_reserve(dev, &__size);
+    if (!__ptr)
+      break;
+    memcpy(__ptr, (const unsigned char *)src + __done, __size);
+    spsc_dev_commit(dev, __size);
+    __done += __size;
+  }
+  return __done;
+}
+uint32_t spsc_dev_read(struct spsc_dev *dev, void *dest, uint32_t size) {
+  uint32_t __done = 0;
+  while (__done < size) {
+    uint32_t __size = size - __done;
+    const void *const __ptr = spsc_dev_peek(dev, &__size);
+    if (!__ptr)
+      break;
+    memcpy((unsigned char *)dest + __done, __ptr, __size);
+    spsc_dev_release(dev, __size);
+    __done += __size;
+  }
+  return __done;
+}
+
+void spsc_dev_publish_write(struct spsc_dev *dev) {
+  smp_store_release(&dev->ring->pos_w, dev->pos_w_next);
+  _spsc_dev_wake(dev);
+}
+void spsc_dev_publish_read(struct spsc_dev *dev) {
+  smp_store_release(&dev->ring->pos_r, dev->pos_r_next);
+  _spsc_dev_wake(dev);
+}
+
+/* Return nonzero also if corrupted not to sleep forever. */
+static int _spsc_dev_check_read(struct spsc_dev *dev, uint32_t size) {
+  _spsc_dev_arm(dev->ring);
+  _spsc_dev_load(dev, &dev->ring->pos_w, &dev->pos_w_cache);
+  return READ_ONCE(dev->corrupted) ||
+         _spsc_dev_used(dev->pos_r_next, dev->pos_w_cache, dev->ring_size) >=
+             size;
+}
+static int _spsc_dev_check_write(struct spsc_dev *dev, uint32_t size) {
+  _spsc_dev_arm(dev->ring);
+  _spsc_dev_load(dev, &dev->ring->pos_r, &dev->pos_r_cache);
+  return READ_ONCE(dev->corrupted) ||
+         _spsc_dev_free(dev->pos_r_cache, dev->pos_w_next, dev->ring_size) >=
+             size;
+}
+int spsc_dev_wait_read(struct spsc_dev *dev, uint32_t size) {
+  const int __ret =
+      wait_event_interruptible(dev->wq, _spsc_dev_check_read(dev, size));
+  return __ret ? __ret : READ_ONCE(dev->corrupted) ? -EIO : 0;
+}
+int spsc_dev_wait_write(struct spsc_dev *dev, uint32_t size) {
+  const int __ret =
+      wait_event_interruptible(dev->wq, _spsc_dev_check_write(dev, size));
+  return __ret ? __ret : READ_ONCE(dev->corrupted) ? -EIO : 0;
+}
@@ -1,5 +1,16 @@
 #include "x86linux/helper.h"
 
+#ifndef __KERNEL__
+
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#endif
+
 unsigned char bitset_test(const bitset_t *restrict bitset32, uint32_t idx) {
   const uint32_t r32_bitset = *(((uint32_t *)bitset32) + (idx >> 5));
 
@@ -35,8 +46,231 @@ unsigned char bitset_unset(bitset_t *restrict bitset32, uint32_t idx) {
   return __cf;
 }
 
-int32_t bitset_search_lowest(const bitset_t *restrict bitset,
-                             uint32_t start_idx, uint32_t last_idx) {
+unsigned char bitset_test64(const bitset_t *restrict bitset, uint64_t idx) {
+  const bitset_t r64_bitset = *(bitset + (idx >> 6));
+
+  register unsigned char __cf asm("al");
+  asm volatile("btq %2, %1\n\t"
+               "setc %0"
+               : "=a"(__cf)
+               : "r"(r64_bitset), "Jr"(idx)
+               : "cc");
+  return __cf;
+}
+
+unsigned char bitset_set64(bitset_t *restrict bitset, uint64_t idx) {
+  bitset_t *const restrict __bitset = bitset + (idx >> 6);
+
+  register unsigned char __cf asm("al");
+  asm volatile("btsq %2, %1\n\t"
+               "setc %0"
+               : "=a"(__cf), "+r"(*__bitset)
+               : "Jr"(idx)
+               : "cc");
+  return __cf;
+}
+unsigned char bitset_unset64(bitset_t *restrict bitset, uint64_t idx) {
+  bitset_t *const restrict __bitset = bitset + (idx >> 6);
+
+  register unsigned char __cf asm("al");
+  asm volatile("btrq %2, %1\n\t"
+               "setc %0"
+               : "=a"(__cf), "+r"(*__bitset)
+               : "Jr"(idx)
+               : "cc");
+  return __cf;
+}
+
+/* Word scanning kernels */
+
+/* Return the mask of the word `idx` for bits within [start_idx, last_idx]. */
+static __always_inline bitset_t _bitset_mask(size_t idx, uint64_t start_idx,
+                                             uint64_t last_idx) {
+  bitset_t __mask = UINT64_MAX;
+  if (idx == (start_idx >> 6))
+    __mask &= UINT64_MAX << (start_idx & 0x3F);
+  if (idx == (last_idx >> 6))
+    __mask &= UINT64_MAX >> (0x3F - (last_idx & 0x3F));
+  return __mask;
+}
+
+/*
+ * Return the index of the first non-zero word in [idx, last], or the value
+ * greater than `last` if there is none.
+ */
+static __always_inline size_t _bitset_scan(const bitset_t *restrict bitset,
+                                           size_t idx, size_t last) {
+  while (likely(last >= idx) && !*(bitset + idx))
+    ++idx;
+  return idx;
+}
+/* Same as _bitset_scan(), but for the intersection of two bitsets. */
+static __always_inline size_t
+_bitset_scan_common(const bitset_t *restrict bitset,
+                    const bitset_t *restrict bitset2, size_t idx, size_t last) {
+  while (likely(last >= idx) && !(*(bitset + idx) & *(bitset2 + idx)))
+    ++idx;
+  return idx;
+}
+/* Same as _bitset_scan(), but for the first word which is not full. */
+static __always_inline size_t _bitset_scan_zero(const bitset_t *restrict bitset,
+                                                size_t idx, size_t last) {
+  while (likely(last >= idx) && !~*(bitset + idx))
+    ++idx;
+  return idx;
+}
+/*
+ * Return the index of the last non-zero word in [first, end), or SIZE_MAX if
+ * there is none.
+ */
+static __always_inline size_t _bitset_rscan(const bitset_t *restrict bitset,
+                                            size_t first, size_t end) {
+  while (likely(end > first))
+    if (*(bitset + --end))
+      return end;
+  return SIZE_MAX;
+}
+
+#ifndef __KERNEL__
+
+/* Test 256 bits per iteration, then find the exact word with scalar loop. */
+static __attribute((target("avx2"))) size_t
+_bitset_scan_avx2(const bitset_t *restrict bitset, size_t idx, size_t last) {
+  for (; likely(last >= idx + 3); idx += 4) {
+    const __m256i __v = _mm256_loadu_si256((const __m256i *)(bitset + idx));
+    if (!_mm256_testz_si256(__v, __v))
+      break;
+  }
+  return _bitset_scan(bitset, idx, last);
+}
+static __attribute((target("avx2"))) size_t
+_bitset_scan_common_avx2(const bitset_t *restrict bitset,
+                         const bitset_t *restrict bitset2, size_t idx,
+                         size_t last) {
+  for (; likely(last >= idx + 3); idx += 4) {
+    const __m256i __v = _mm256_loadu_si256((const __m256i *)(bitset + idx));
+    const __m256i __v2 = _mm256_loadu_si256((const __m256i *)(bitset2 + idx));
+    if (!_mm256_testz_si256(__v, __v2))
+      break;
+  }
+  return _bitset_scan_common(bitset, bitset2, idx, last);
+}
+
+/* Test 512 bits per iteration; The mask directly points the exact word. */
+static __attribute((target("avx512f"))) size_t
+_bitset_scan_avx512(const bitset_t *restrict bitset, size_t idx, size_t last) {
+  for (; likely(last >= idx + 7); idx += 8) {
+    const __m512i __v = _mm512_loadu_si512(bitset + idx);
+    const __mmask8 __m = _mm512_test_epi64_mask(__v, __v);
+    if (__m)
+      return idx + __builtin_ctz(__m);
+  }
+  return _bitset_scan(bitset, idx, last);
+}
+static __attribute((target("avx512f"))) size_t
+_bitset_scan_common_avx512(const bitset_t *restrict bitset,
+                           const bitset_t *restrict bitset2, size_t idx,
+                           size_t last) {
+  for (; likely(last >= idx + 7); idx += 8) {
+    const __mmask8 __m = _mm512_test_epi64_mask(
+        _mm512_loadu_si512(bitset + idx), _mm512_loadu_si512(bitset2 + idx));
+    if (__m)
+      return idx + __builtin_ctz(__m);
+  }
+  return _bitset_scan_common(bitset, bitset2, idx, last);
+}
+
+static __attribute((target("avx2"))) size_t
+_bitset_scan_zero_avx2(const bitset_t *restrict bitset, size_t idx,
+                       size_t last) {
+  const __m256i __ones = _mm256_set1_epi64x(-1);
+  for (; likely(last >= idx + 3); idx += 4)
+    if (!_mm256_testc_si256(
+            _mm256_loadu_si256((const __m256i *)(bitset + idx)), __ones))
+      break;
+  return _bitset_scan_zero(bitset, idx, last);
+}
+static __attribute((target("avx512f"))) size_t
+_bitset_scan_zero_avx512(const bitset_t *restrict bitset, size_t idx,
+                         size_t last) {
+  const __m512i __ones = _mm512_set1_epi64(-1);
+  for (; likely(last >= idx + 7); idx += 8) {
+    const __mmask8 __m =
+        _mm512_cmpneq_epi64_mask(_mm512_loadu_si512(bitset + idx), __ones);
+    if (__m)
+      return idx + __builtin_ctz(__m);
+  }
+  return _bitset_scan_zero(bitset, idx, last);
+}
+
+static __attribute((target("avx2"))) size_t
+_bitset_rscan_avx2(const bitset_t *restrict bitset, size_t first, size_t end) {
+  for (; likely(end >= first + 4); end -= 4) {
+    const __m256i __v = _mm256_loadu_si256((const __m256i *)(bitset + end - 4));
+    if (!_mm256_testz_si256(__v, __v))
+      break;
+  }
+  return _bitset_rscan(bitset, first, end);
+}
+static __attribute((target("avx512f"))) size_t
+_bitset_rscan_avx512(const bitset_t *restrict bitset, size_t first,
+                     size_t end) {
+  for (; likely(end >= first + 8); end -= 8) {
+    const __m512i __v = _mm512_loadu_si512(bitset + end - 8);
+    const __mmask8 __m = _mm512_test_epi64_mask(__v, __v);
+    if (__m)
+      return end - 8 + (31 - __builtin_clz(__m));
+  }
+  return _bitset_rscan(bitset, first, end);
+}
+
+#endif
+
+static size_t _bitset_scan_dispatch(const bitset_t *restrict bitset,
+                                    size_t idx, size_t last) {
+#ifndef __KERNEL__
+  if (x86_support_avx512)
+    return _bitset_scan_avx512(bitset, idx, last);
+  if (x86_support_avx2)
+    return _bitset_scan_avx2(bitset, idx, last);
+#endif
+  return _bitset_scan(bitset, idx, last);
+}
+static size_t _bitset_scan_common_dispatch(const bitset_t *restrict bitset,
+                                           const bitset_t *restrict bitset2,
+                                           size_t idx, size_t last) {
+#ifndef __KERNEL__
+  if (x86_support_avx512)
+    return _bitset_scan_common_avx512(bitset, bitset2, idx, last);
+  if (x86_support_avx2)
+    return _bitset_scan_common_avx2(bitset, bitset2, idx, last);
+#endif
+  return _bitset_scan_common(bitset, bitset2, idx, last);
+}
+static size_t _bitset_scan_zero_dispatch(const bitset_t *restrict bitset,
+                                         size_t idx, size_t last) {
+#ifndef __KERNEL__
+  if (x86_support_avx512)
+    return _bitset_scan_zero_avx512(bitset, idx, last);
+  if (x86_support_avx2)
+    return _bitset_scan_zero_avx2(bitset, idx, last);
+#endif
+  return _bitset_scan_zero(bitset, idx, last);
+}
+static size_t _bitset_rscan_dispatch(const bitset_t *restrict bitset,
+                                     size_t first, size_t end) {
+#ifndef __KERNEL__
+  if (x86_support_avx512)
+    return _bitset_rscan_avx512(bitset, first, end);
+  if (x86_support_avx2)
+    return _bitset_rscan_avx2(bitset, first, end);
+#endif
+  return _bitset_rscan(bitset, first, end);
+}
+
+static __always_inline int64_t
+_bitset_search_lowest(const bitset_t *restrict bitset, uint64_t start_idx,
+                      uint64_t last_idx) {
   bitset_t __tmp = start_idx & 0x3F;
   if (__tmp) {
     bitset_t __res = *(bitset + (start_idx >> 6)) & (UINT64_MAX << __tmp);
@@ -46,22 +280,28 @@ int32_t bitset_search_lowest(const bitset_t *restrict bitset,
                  : (int64_t)((start_idx & -0x40) + __builtin_ctzll(__res));
   }
 
-  __tmp = ((start_idx >> 6) + !!__tmp);
-  while (likely((last_idx >> 6) >= __tmp)) {
-    bitset_t __res = *(bitset + __tmp);
-    if (__res) {
-      __res = __builtin_ctzll(__res);
-      return ((__tmp << 6) + __res > last_idx)
-                 ? -1
-                 : (int64_t)((__tmp << 6) + __res);
-    }
-    ++__tmp;
+  __tmp = _bitset_scan_dispatch(bitset, (start_idx >> 6) + !!__tmp,
+                                last_idx >> 6);
+  if (likely((last_idx >> 6) >= __tmp)) {
+    const bitset_t __res = __builtin_ctzll(*(bitset + __tmp));
+    return ((__tmp << 6) + __res > last_idx) ? -1
+                                             : (int64_t)((__tmp << 6) + __res);
   }
   return -1;
 }
-int32_t bitset_search_lowest_common(const bitset_t *restrict bitset,
-                                    const bitset_t *restrict bitset2,
-                                    uint32_t start_idx, uint32_t last_idx) {
+int32_t bitset_search_lowest(const bitset_t *restrict bitset,
+                             uint32_t start_idx, uint32_t last_idx) {
+  return _bitset_search_lowest(bitset, start_idx, last_idx);
+}
+int64_t bitset_search_lowest64(const bitset_t *restrict bitset,
+                               uint64_t start_idx, uint64_t last_idx) {
+  return _bitset_search_lowest(bitset, start_idx, last_idx);
+}
+
+static __always_inline int64_t
+_bitset_search_lowest_common(const bitset_t *restrict bitset,
+                             const bitset_t *restrict bitset2,
+                             uint64_t start_idx, uint64_t last_idx) {
   bitset_t __tmp = start_idx & 0x3F;
   if (__tmp) {
     bitset_t __res = *(bitset + (start_idx >> 6)) &
@@ -72,16 +312,912 @@ int32_t bitset_search_lowest_common(const bitset_t *restrict bitset,
                  : (int64_t)((start_idx & -0x40) + __builtin_ctzll(__res));
   }
 
-  __tmp = ((start_idx >> 6) + !!__tmp);
-  while (likely((last_idx >> 6) >= __tmp)) {
-    bitset_t __res = *(bitset + __tmp) & *(bitset2 + __tmp);
+  __tmp = _bitset_scan_common_dispatch(
+      bitset, bitset2, (start_idx >> 6) + !!__tmp, last_idx >> 6);
+  if (likely((last_idx >> 6) >= __tmp)) {
+    const bitset_t __res =
+        __builtin_ctzll(*(bitset + __tmp) & *(bitset2 + __tmp));
+    return ((__tmp << 6) + __res > last_idx) ? -1
+                                             : (int64_t)((__tmp << 6) + __res);
+  }
+  return -1;
+}
+int32_t bitset_search_lowest_common(const bitset_t *restrict bitset,
+                                    const bitset_t *restrict bitset2,
+                                    uint32_t start_idx, uint32_t last_idx) {
+  return _bitset_search_lowest_common(bitset, bitset2, start_idx, last_idx);
+}
+int64_t bitset_search_lowest_common64(const bitset_t *restrict bitset,
+                                      const bitset_t *restrict bitset2,
+                                      uint64_t start_idx, uint64_t last_idx) {
+  return _bitset_search_lowest_common(bitset, bitset2, start_idx, last_idx);
+}
+
+static __always_inline int64_t
+_bitset_search_lowest_zero(const bitset_t *restrict bitset, uint64_t start_idx,
+                           uint64_t last_idx) {
+  if (unlikely(start_idx > last_idx))
+    return -1;
+
+  size_t __idx = start_idx >> 6;
+  bitset_t __res = ~*(bitset + __idx) & (UINT64_MAX << (start_idx & 0x3F));
+  if (!__res) {
+    __idx = _bitset_scan_zero_dispatch(bitset, __idx + 1, last_idx >> 6);
+    if (__idx > (last_idx >> 6))
+      return -1;
+    __res = ~*(bitset + __idx);
+  }
+
+  __res = (__idx << 6) + __builtin_ctzll(__res);
+  return __res > last_idx ? -1 : (int64_t)__res;
+}
+int32_t bitset_search_lowest_zero(const bitset_t *restrict bitset,
+                                  uint32_t start_idx, uint32_t last_idx) {
+  return _bitset_search_lowest_zero(bitset, start_idx, last_idx);
+}
+int64_t bitset_search_lowest_zero64(const bitset_t *restrict bitset,
+                                    uint64_t start_idx, uint64_t last_idx) {
+  return _bitset_search_lowest_zero(bitset, start_idx, last_idx);
+}
+
+static __always_inline int64_t
+_bitset_search_highest(const bitset_t *restrict bitset, uint64_t start_idx,
+                       uint64_t last_idx) {
+  if (unlikely(start_idx > last_idx))
+    return -1;
+
+  size_t __idx = last_idx >> 6;
+  bitset_t __res = *(bitset + __idx) & _bitset_mask(__idx, start_idx, last_idx);
+  if (!__res) {
+    __idx = _bitset_rscan_dispatch(bitset, start_idx >> 6, __idx);
+    if (__idx == SIZE_MAX)
+      return -1;
+    __res = *(bitset + __idx) & _bitset_mask(__idx, start_idx, last_idx);
+    if (!__res)
+      return -1;
+  }
+  return (__idx << 6) + (0x3F - __builtin_clzll(__res));
+}
+int32_t bitset_search_highest(const bitset_t *restrict bitset,
+                              uint32_t start_idx, uint32_t last_idx) {
+  return _bitset_search_highest(bitset, start_idx, last_idx);
+}
+int64_t bitset_search_highest64(const bitset_t *restrict bitset,
+                                uint64_t start_idx, uint64_t last_idx) {
+  return _bitset_search_highest(bitset, start_idx, last_idx);
+}
+
+/* Set bit extraction */
+
+/* Decode set bits of `word` (at most `nr`) into `idxs` with TZCNT/BLSR. */
+static __always_inline uint32_t _bitset_decode(bitset_t word, uint32_t base,
+                                               uint32_t *restrict idxs,
+                                               uint32_t nr) {
+  uint32_t __nr = 0;
+  for (; word && __nr < nr; word &= word - 1)
+    *(idxs + __nr++) = base + __builtin_ctzll(word);
+  return __nr;
+}
+
+static uint32_t _bitset_extract(const bitset_t *restrict bitset,
+                                uint32_t start_idx, uint32_t last_idx,
+                                uint32_t *restrict idxs, uint32_t nr) {
+  uint32_t __nr = 0;
+  size_t __idx = start_idx >> 6;
+  const size_t __last = last_idx >> 6;
+  while (__nr < nr && likely(__last >= __idx)) {
+    const bitset_t __word = *(bitset + __idx);
+    if (!__word) {
+      __idx = _bitset_scan_dispatch(bitset, __idx + 1, __last);
+      continue;
+    }
+    __nr += _bitset_decode(__word & _bitset_mask(__idx, start_idx, last_idx),
+                           __idx << 6, idxs + __nr, nr - __nr);
+    ++__idx;
+  }
+  return __nr;
+}
+
+#ifndef __KERNEL__
+
+/*
+ * Decode all set bits of `word` into `idxs` with VPCOMPRESSD (16 bits per
+ * iteration), and return the number of them.
+ */
+static __always_inline __attribute((target("avx512f,popcnt"))) uint32_t
+_bitset_decode_avx512(bitset_t word, uint32_t base, uint32_t *restrict idxs) {
+  const __m512i __iota = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                           11, 12, 13, 14, 15);
+  uint32_t __nr = 0;
+  for (; word; word >>= 16, base += 16) {
+    const __mmask16 __m = (uint16_t)word;
+    const uint32_t __cnt = __builtin_popcount(__m);
+    _mm512_mask_storeu_epi32(
+        idxs + __nr, (__mmask16)((1u << __cnt) - 1),
+        _mm512_maskz_compress_epi32(
+            __m, _mm512_add_epi32(_mm512_set1_epi32(base), __iota)));
+    __nr += __cnt;
+  }
+  return __nr;
+}
+static __attribute((target("avx512f,popcnt"))) uint32_t
+_bitset_extract_avx512(const bitset_t *restrict bitset, uint32_t start_idx,
+                       uint32_t last_idx, uint32_t *restrict idxs,
+                       uint32_t nr) {
+  uint32_t __nr = 0;
+  size_t __idx = start_idx >> 6;
+  const size_t __last = last_idx >> 6;
+  while (__nr < nr && likely(__last >= __idx)) {
+    bitset_t __word = *(bitset + __idx);
+    if (!__word) {
+      __idx = _bitset_scan_avx512(bitset, __idx + 1, __last);
+      continue;
+    }
+    __word &= _bitset_mask(__idx, start_idx, last_idx);
+
+    /* TZCNT/BLSR loop is faster for the sparse word. */
+    const uint32_t __cnt = __builtin_popcountll(__word);
+    if (__cnt >= 8 && nr - __nr >= __cnt)
+      __nr += _bitset_decode_avx512(__word, __idx << 6, idxs + __nr);
+    else
+      __nr += _bitset_decode(__word, __idx << 6, idxs + __nr, nr - __nr);
+    ++__idx;
+  }
+  return __nr;
+}
+
+#endif
+
+uint32_t bitset_extract(const bitset_t *restrict bitset, uint32_t start_idx,
+                        uint32_t last_idx, uint32_t *restrict idxs,
+                        uint32_t nr) {
+  if (unlikely(start_idx > last_idx))
+    return 0;
+
+#ifndef __KERNEL__
+  if (x86_support_avx512)
+    return _bitset_extract_avx512(bitset, start_idx, last_idx, idxs, nr);
+#endif
+  return _bitset_extract(bitset, start_idx, last_idx, idxs, nr);
+}
+uint32_t bitset_extract64(const bitset_t *restrict bitset, uint64_t start_idx,
+                          uint64_t last_idx, uint64_t *restrict idxs,
+                          uint32_t nr) {
+  if (unlikely(start_idx > last_idx))
+    return 0;
+
+  /* Only the scan is vectorized (VPCOMPRESSD is for the 32-bit indexes). */
+  uint32_t __nr = 0;
+  size_t __idx = start_idx >> 6;
+  const size_t __last = last_idx >> 6;
+  while (__nr < nr && likely(__last >= __idx)) {
+    bitset_t __word = *(bitset + __idx);
+    if (!__word) {
+      __idx = _bitset_scan_dispatch(bitset, __idx + 1, __last);
+      continue;
+    }
+    for (__word &= _bitset_mask(__idx, start_idx, last_idx);
+         __word && __nr < nr; __word &= __word - 1)
+      *(idxs + __nr++) = (__idx << 6) + __builtin_ctzll(__word);
+    ++__idx;
+  }
+  return __nr;
+}
+
+/* Bulk operations */
+
+typedef void (*_bitset_op_fn)(bitset_t *restrict dest,
+                              const bitset_t *restrict src, size_t idx,
+                              size_t last);
+/* Apply `op` to the edge words with the mask, then `op_*` to the rest. */
+static __always_inline void
+_bitset_op(bitset_t *restrict dest, const bitset_t *restrict src,
+           uint64_t start_idx, uint64_t last_idx, _bitset_op_fn op,
+           _bitset_op_fn op_avx2, _bitset_op_fn op_avx512) {
+  if (unlikely(start_idx > last_idx))
+    return;
+
+  size_t __idx = start_idx >> 6, __last = last_idx >> 6;
+  bitset_t __word = *(dest + __idx);
+  const bitset_t __mask = _bitset_mask(__idx, start_idx, last_idx);
+  op(&__word, src + __idx, 0, 0);
+  *(dest + __idx) = (*(dest + __idx) & ~__mask) | (__word & __mask);
+  if (__idx == __last)
+    return;
+
+  __word = *(dest + __last);
+  const bitset_t __mask_last = _bitset_mask(__last, start_idx, last_idx);
+  op(&__word, src + __last, 0, 0);
+  *(dest + __last) = (*(dest + __last) & ~__mask_last) | (__word & __mask_last);
+
+#ifndef __KERNEL__
+  if (x86_support_avx512)
+    op_avx512(dest, src, __idx + 1, __last - 1);
+  else if (x86_support_avx2)
+    op_avx2(dest, src, __idx + 1, __last - 1);
+  else
+#endif
+    op(dest, src, __idx + 1, __last - 1);
+}
+
+#ifndef __KERNEL__
+
+/* Generic vector types to let the compiler emit YMM/ZMM for the target */
+typedef bitset_t _bitset_v256_t __attribute((vector_size(32), aligned(8)));
+typedef bitset_t _bitset_v512_t __attribute((vector_size(64), aligned(8)));
+
+#define _BITSET_DEFINE_OP_KERNELS(name, op)                                    \
+  static __attribute((target("avx2"))) void _bitset_##name##_avx2(             \
+      bitset_t *restrict dest, const bitset_t *restrict src, size_t idx,       \
+      size_t last) {                                                           \
+    for (; likely(last >= idx + 3); idx += 4)                                  \
+      *(_bitset_v256_t *)(dest + idx) = *(_bitset_v256_t *)(dest + idx)        \
+          op *(const _bitset_v256_t *)(src + idx);                             \
+    _bitset_##name(dest, src, idx, last);                                      \
+  }                                                                            \
+  static __attribute((target("avx512f"))) void _bitset_##name##_avx512(        \
+      bitset_t *restrict dest, const bitset_t *restrict src, size_t idx,       \
+      size_t last) {                                                           \
+    for (; likely(last >= idx + 7); idx += 8)                                  \
+      *(_bitset_v512_t *)(dest + idx) = *(_bitset_v512_t *)(dest + idx)        \
+          op *(const _bitset_v512_t *)(src + idx);                             \
+    _bitset_##name(dest, src, idx, last);                                      \
+  }
+
+#else
+
+#define _BITSET_DEFINE_OP_KERNELS(name, op)
+#define _bitset_and_avx2 NULL
+#define _bitset_and_avx512 NULL
+#define _bitset_or_avx2 NULL
+#define _bitset_or_avx512 NULL
+#define _bitset_xor_avx2 NULL
+#define _bitset_xor_avx512 NULL
+
+#endif
+
+/* Define bitset_<name>() which applies `dest op= src` within the range. */
+#define _BITSET_DEFINE_OP(name, op)                                            \
+  static void _bitset_##name(bitset_t *restrict dest,                          \
+                             const bitset_t *restrict src, size_t idx,         \
+                             size_t last) {                                    \
+    for (; likely(last >= idx); ++idx)                                         \
+      *(dest + idx) = *(dest + idx) op *(src + idx);                           \
+  }                                                                            \
+  _BITSET_DEFINE_OP_KERNELS(name, op)                                          \
+  void bitset_##name(bitset_t *restrict dest, const bitset_t *restrict src,    \
+                     uint32_t start_idx, uint32_t last_idx) {                  \
+    _bitset_op(dest, src, start_idx, last_idx, _bitset_##name,                 \
+               _bitset_##name##_avx2, _bitset_##name##_avx512);                \
+  }                                                                            \
+  void bitset_##name##64(bitset_t *restrict dest,                              \
+                         const bitset_t *restrict src, uint64_t start_idx,     \
+                         uint64_t last_idx) {                                  \
+    _bitset_op(dest, src, start_idx, last_idx, _bitset_##name,                 \
+               _bitset_##name##_avx2, _bitset_##name##_avx512);                \
+  }
+_BITSET_DEFINE_OP(and, &)
+_BITSET_DEFINE_OP(or, |)
+_BITSET_DEFINE_OP(xor, ^)
+
+/* ANDNOT needs the complement of `src`, so it is written out. */
+static void _bitset_andnot(bitset_t *restrict dest,
+                           const bitset_t *restrict src, size_t idx,
+                           size_t last) {
+  for (; likely(last >= idx); ++idx)
+    *(dest + idx) &= ~*(src + idx);
+}
+
+#ifndef __KERNEL__
+
+static __attribute((target("avx2"))) void
+_bitset_andnot_avx2(bitset_t *restrict dest, const bitset_t *restrict src,
+                    size_t idx, size_t last) {
+  for (; likely(last >= idx + 3); idx += 4)
+    *(_bitset_v256_t *)(dest + idx) &= ~*(const _bitset_v256_t *)(src + idx);
+  _bitset_andnot(dest, src, idx, last);
+}
+static __attribute((target("avx512f"))) void
+_bitset_andnot_avx512(bitset_t *restrict dest, const bitset_t *restrict src,
+                      size_t idx, size_t last) {
+  for (; likely(last >= idx + 7); idx += 8)
+    *(_bitset_v512_t *)(dest + idx) &= ~*(const _bitset_v512_t *)(src + idx);
+  _bitset_andnot(dest, src, idx, last);
+}
+
+#else
+
+#define _bitset_andnot_avx2 NULL
+#define _bitset_andnot_avx512 NULL
+
+#endif
+
+void bitset_andnot(bitset_t *restrict dest, const bitset_t *restrict src,
+                   uint32_t start_idx, uint32_t last_idx) {
+  _bitset_op(dest, src, start_idx, last_idx, _bitset_andnot,
+             _bitset_andnot_avx2, _bitset_andnot_avx512);
+}
+void bitset_andnot64(bitset_t *restrict dest, const bitset_t *restrict src,
+                     uint64_t start_idx, uint64_t last_idx) {
+  _bitset_op(dest, src, start_idx, last_idx, _bitset_andnot,
+             _bitset_andnot_avx2, _bitset_andnot_avx512);
+}
+
+static void _bitset_fill(bitset_t *restrict bitset, uint64_t start_idx,
+                         uint64_t last_idx, int c) {
+  if (unlikely(start_idx > last_idx))
+    return;
+
+  size_t __idx = start_idx >> 6, __last = last_idx >> 6;
+  const bitset_t __mask = _bitset_mask(__idx, start_idx, last_idx);
+  *(bitset + __idx) = c ? *(bitset + __idx) | __mask
+                        : *(bitset + __idx) & ~__mask;
+  if (__idx == __last)
+    return;
+
+  const bitset_t __mask_last = _bitset_mask(__last, start_idx, last_idx);
+  *(bitset + __last) = c ? *(bitset + __last) | __mask_last
+                         : *(bitset + __last) & ~__mask_last;
+
+  /* The middle words are filled with (already vectorized) memset(). */
+  if (__last - __idx > 1)
+    __builtin_memset(bitset + __idx + 1, c ? 0xFF : 0,
+                     (__last - __idx - 1) * sizeof(bitset_t));
+}
+void bitset_set_range(bitset_t *restrict bitset, uint32_t start_idx,
+                      uint32_t last_idx) {
+  _bitset_fill(bitset, start_idx, last_idx, 1);
+}
+void bitset_unset_range(bitset_t *restrict bitset, uint32_t start_idx,
+                        uint32_t last_idx) {
+  _bitset_fill(bitset, start_idx, last_idx, 0);
+}
+void bitset_set_range64(bitset_t *restrict bitset, uint64_t start_idx,
+                        uint64_t last_idx) {
+  _bitset_fill(bitset, start_idx, last_idx, 1);
+}
+void bitset_unset_range64(bitset_t *restrict bitset, uint64_t start_idx,
+                          uint64_t last_idx) {
+  _bitset_fill(bitset, start_idx, last_idx, 0);
+}
+
+static __always_inline uint64_t _bitset_count(const bitset_t *restrict bitset,
+                                              size_t idx, size_t last) {
+  uint64_t __cnt = 0;
+  for (; likely(last >= idx); ++idx)
+    __cnt += __builtin_popcountll(*(bitset + idx));
+  return __cnt;
+}
+
+#ifndef __KERNEL__
+
+/* Count with the nibble lookup table (PSHUFB) and sum bytes with PSADBW. */
+static __attribute((target("avx2"))) uint64_t
+_bitset_count_avx2(const bitset_t *restrict bitset, size_t idx, size_t last) {
+  const __m256i __lut =
+      _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1,
+                       2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i __low = _mm256_set1_epi8(0x0F);
+  __m256i __acc = _mm256_setzero_si256();
+  for (; likely(last >= idx + 3); idx += 4) {
+    const __m256i __v = _mm256_loadu_si256((const __m256i *)(bitset + idx));
+    const __m256i __cnt = _mm256_add_epi8(
+        _mm256_shuffle_epi8(__lut, _mm256_and_si256(__v, __low)),
+        _mm256_shuffle_epi8(
+            __lut, _mm256_and_si256(_mm256_srli_epi16(__v, 4), __low)));
+    __acc = _mm256_add_epi64(__acc,
+                             _mm256_sad_epu8(__cnt, _mm256_setzero_si256()));
+  }
+  return _mm256_extract_epi64(__acc, 0) + _mm256_extract_epi64(__acc, 1) +
+         _mm256_extract_epi64(__acc, 2) + _mm256_extract_epi64(__acc, 3) +
+         _bitset_count(bitset, idx, last);
+}
+static __attribute((target("avx512f,avx512bw"))) uint64_t
+_bitset_count_avx512(const bitset_t *restrict bitset, size_t idx,
+                     size_t last) {
+  const __m512i __lut = _mm512_broadcast_i32x4(
+      _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4));
+  const __m512i __low = _mm512_set1_epi8(0x0F);
+  __m512i __acc = _mm512_setzero_si512();
+  for (; likely(last >= idx + 7); idx += 8) {
+    const __m512i __v = _mm512_loadu_si512(bitset + idx);
+    const __m512i __cnt = _mm512_add_epi8(
+        _mm512_shuffle_epi8(__lut, _mm512_and_si512(__v, __low)),
+        _mm512_shuffle_epi8(
+            __lut, _mm512_and_si512(_mm512_srli_epi16(__v, 4), __low)));
+    __acc = _mm512_add_epi64(__acc,
+                             _mm512_sad_epu8(__cnt, _mm512_setzero_si512()));
+  }
+  return _mm512_reduce_add_epi64(__acc) + _bitset_count(bitset, idx, last);
+}
+
+#endif
+
+static __always_inline uint64_t _bitset_count_range(
+    const bitset_t *restrict bitset, uint64_t start_idx, uint64_t last_idx) {
+  if (unlikely(start_idx > last_idx))
+    return 0;
+
+  size_t __idx = start_idx >> 6, __last = last_idx >> 6;
+  uint64_t __cnt = __builtin_popcountll(
+      *(bitset + __idx) & _bitset_mask(__idx, start_idx, last_idx));
+  if (__idx == __last)
+    return __cnt;
+  __cnt += __builtin_popcountll(*(bitset + __last) &
+                                _bitset_mask(__last, start_idx, last_idx));
+  ++__idx, --__last;
+
+#ifndef __KERNEL__
+  if (x86_support_avx512)
+    return __cnt + _bitset_count_avx512(bitset, __idx, __last);
+  if (x86_support_avx2)
+    return __cnt + _bitset_count_avx2(bitset, __idx, __last);
+#endif
+  return __cnt + _bitset_count(bitset, __idx, __last);
+}
+uint64_t bitset_count(const bitset_t *restrict bitset, uint32_t start_idx,
+                      uint32_t last_idx) {
+  return _bitset_count_range(bitset, start_idx, last_idx);
+}
+uint64_t bitset_count64(const bitset_t *restrict bitset, uint64_t start_idx,
+                        uint64_t last_idx) {
+  return _bitset_count_range(bitset, start_idx, last_idx);
+}
+
+/*
+ * Return the index of the first word in [idx, last] where the intersection of
+ * all bitsets is non-empty, or the value greater than `last` if there is none.
+ */
+static __always_inline size_t
+_bitset_scan_common_n(const bitset_t *const restrict *restrict bitsets,
+                      uint32_t nr_bitsets, size_t idx, size_t last) {
+  for (; likely(last >= idx); ++idx) {
+    bitset_t __res = *(*bitsets + idx);
+    for (uint32_t __i = 1; __res && __i < nr_bitsets; ++__i)
+      __res &= *(*(bitsets + __i) + idx);
+    if (__res)
+      break;
+  }
+  return idx;
+}
+
+#ifndef __KERNEL__
+
+static __attribute((target("avx2"))) size_t
+_bitset_scan_common_n_avx2(const bitset_t *const restrict *restrict bitsets,
+                           uint32_t nr_bitsets, size_t idx, size_t last) {
+  for (; likely(last >= idx + 3); idx += 4) {
+    __m256i __v = _mm256_loadu_si256((const __m256i *)(*bitsets + idx));
+    for (uint32_t __i = 1;
+         !_mm256_testz_si256(__v, __v) && __i < nr_bitsets; ++__i)
+      __v = _mm256_and_si256(
+          __v, _mm256_loadu_si256((const __m256i *)(*(bitsets + __i) + idx)));
+    if (!_mm256_testz_si256(__v, __v))
+      break;
+  }
+  return _bitset_scan_common_n(bitsets, nr_bitsets, idx, last);
+}
+static __attribute((target("avx512f"))) size_t
+_bitset_scan_common_n_avx512(const bitset_t *const restrict *restrict bitsets,
+                             uint32_t nr_bitsets, size_t idx, size_t last) {
+  for (; likely(last >= idx + 7); idx += 8) {
+    __m512i __v = _mm512_loadu_si512(*bitsets + idx);
+    __mmask8 __m = _mm512_test_epi64_mask(__v, __v);
+    for (uint32_t __i = 1; __m && __i < nr_bitsets; ++__i) {
+      __v = _mm512_and_si512(__v, _mm512_loadu_si512(*(bitsets + __i) + idx));
+      __m = _mm512_test_epi64_mask(__v, __v);
+    }
+    if (__m)
+      return idx + __builtin_ctz(__m);
+  }
+  return _bitset_scan_common_n(bitsets, nr_bitsets, idx, last);
+}
+
+#endif
+
+int32_t bitset_search_lowest_common_n(const bitset_t *const *restrict bitsets,
+                                      uint32_t nr_bitsets, uint32_t start_idx,
+                                      uint32_t last_idx) {
+  if (unlikely(!nr_bitsets || start_idx > last_idx))
+    return -1;
+
+  size_t __idx = start_idx >> 6;
+  const size_t __last = last_idx >> 6;
+  bitset_t __res = *(*bitsets + __idx) & (UINT64_MAX << (start_idx & 0x3F));
+  for (uint32_t __i = 1; __res && __i < nr_bitsets; ++__i)
+    __res &= *(*(bitsets + __i) + __idx);
+
+  if (!__res) {
+#ifndef __KERNEL__
+    if (x86_support_avx512)
+      __idx = _bitset_scan_common_n_avx512(bitsets, nr_bitsets, __idx + 1,
+                                           __last);
+    else if (x86_support_avx2)
+      __idx =
+          _bitset_scan_common_n_avx2(bitsets, nr_bitsets, __idx + 1, __last);
+    else
+#endif
+      __idx = _bitset_scan_common_n(bitsets, nr_bitsets, __idx + 1, __last);
+    if (__idx > __last)
+      return -1;
+
+    __res = *(*bitsets + __idx);
+    for (uint32_t __i = 1; __i < nr_bitsets; ++__i)
+      __res &= *(*(bitsets + __i) + __idx);
+  }
+
+  __res = (__idx << 6) + __builtin_ctzll(__res);
+  return __res > last_idx ? -1 : (int64_t)__res;
+}
+
+/* Hierarchical bitset */
+
+static uint32_t _bitset_hier_nr_levels(uint32_t nr_bits) {
+  uint32_t __nr_levels = 1;
+  for (uint64_t __nr = nr_bits; __nr > BITS_PER_BITSET; ++__nr_levels)
+    __nr = BITSET_LEN(__nr);
+  return __nr_levels;
+}
+size_t bitset_hier_size(uint32_t nr_bits) {
+  size_t __size = 0;
+  uint64_t __nr = nr_bits;
+  for (uint32_t __i = _bitset_hier_nr_levels(nr_bits); __i; --__i) {
+    __size += BITSET_SIZE(__nr);
+    __nr = BITSET_LEN(__nr);
+  }
+  return __size;
+}
+void bitset_hier_init(struct bitset_hier *restrict hier,
+                      bitset_t *restrict bitset, uint32_t nr_bits) {
+  __builtin_memset(bitset, 0, bitset_hier_size(nr_bits));
+
+  hier->nr_bits = nr_bits;
+  hier->nr_levels = _bitset_hier_nr_levels(nr_bits);
+
+  /* Lay out the levels contiguously from the leaf level. */
+  uint64_t __nr = nr_bits;
+  for (uint32_t __i = 0; __i < hier->nr_levels; ++__i) {
+    hier->level[__i] = bitset;
+    bitset += BITSET_LEN(__nr);
+    __nr = BITSET_LEN(__nr);
+  }
+}
+
+unsigned char bitset_hier_set(struct bitset_hier *restrict hier,
+                              uint32_t idx) {
+  const bitset_t __old = *(hier->level[0] + (idx >> 6));
+  const unsigned char __ret = bitset_set(hier->level[0], idx);
+
+  /* Propagate upward while the word below has just become non-empty. */
+  if (!__old)
+    for (uint32_t __i = 1; __i < hier->nr_levels; ++__i) {
+      idx >>= 6;
+      if (*(hier->level[__i] + (idx >> 6)) & (1ull << (idx & 0x3F)))
+        break;
+      const bitset_t __old_upper = *(hier->level[__i] + (idx >> 6));
+      bitset_set(hier->level[__i], idx);
+      if (__old_upper)
+        break;
+    }
+  return __ret;
+}
+unsigned char bitset_hier_unset(struct bitset_hier *restrict hier,
+                                uint32_t idx) {
+  const unsigned char __ret = bitset_unset(hier->level[0], idx);
+
+  /* Propagate upward while the word below has just become empty. */
+  if (__ret)
+    for (uint32_t __i = 1; __i < hier->nr_levels; ++__i) {
+      if (*(hier->level[__i - 1] + (idx >> 6)))
+        break;
+      idx >>= 6;
+      bitset_unset(hier->level[__i], idx);
+    }
+  return __ret;
+}
+
+static void _bitset_hier_propagate_set_atomic(struct bitset_hier *restrict hier,
+                                              uint32_t lvl, uint32_t idx) {
+  const volatile bitset_t *restrict __upper;
+  for (; lvl < hier->nr_levels; ++lvl) {
+    idx >>= 6;
+    __upper = hier->level[lvl] + (idx >> 6);
+    if (*__upper & (1ull << (idx & 0x3F)))
+      break;
+    bitset_set_atomic(hier->level[lvl], idx);
+  }
+}
+unsigned char bitset_hier_set_atomic(struct bitset_hier *restrict hier,
+                                     uint32_t idx) {
+  const unsigned char __ret = bitset_set_atomic(hier->level[0], idx);
+  if (!__ret)
+    _bitset_hier_propagate_set_atomic(hier, 1, idx);
+  return __ret;
+}
+unsigned char bitset_hier_unset_atomic(struct bitset_hier *restrict hier,
+                                       uint32_t idx) {
+  const unsigned char __ret = bitset_unset_atomic(hier->level[0], idx);
+  if (!__ret)
+    return __ret;
+
+  for (uint32_t __i = 1; __i < hier->nr_levels; ++__i) {
+    const volatile bitset_t *restrict const __lower =
+        hier->level[__i - 1] + (idx >> 6);
+    if (*__lower)
+      break;
+    idx >>= 6;
+    bitset_unset_atomic(hier->level[__i], idx);
+
+    /*
+     * A concurrent setter may have filled the word below after we saw it empty
+     * but before it saw the summary bit cleared; Restore the summary then.
+     */
+    if (unlikely(*__lower)) {
+      bitset_set_atomic(hier->level[__i], idx);
+      _bitset_hier_propagate_set_atomic(hier, __i + 1, idx);
+      break;
+    }
+  }
+  return __ret;
+}
+
+int32_t bitset_hier_search_lowest(const struct bitset_hier *restrict hier,
+                                  uint32_t start_idx, uint32_t last_idx) {
+  if (unlikely(!hier->nr_bits))
+    return -1;
+  if (last_idx >= hier->nr_bits)
+    last_idx = hier->nr_bits - 1;
+
+  /* `__idx` is the bit index at the level `__lvl`. */
+  uint32_t __lvl = 0;
+  uint64_t __idx = start_idx;
+  while (likely(__idx <= ((uint64_t)last_idx >> (6 * __lvl)))) {
+    const bitset_t __res = *(hier->level[__lvl] + (__idx >> 6)) &
+                           (UINT64_MAX << (__idx & 0x3F));
     if (__res) {
-      __res = __builtin_ctzll(__res);
-      return ((__tmp << 6) + __res > last_idx)
-                 ? -1
-                 : (int64_t)((__tmp << 6) + __res);
+      __idx = (__idx & -0x40) + __builtin_ctzll(__res);
+      if (__idx > ((uint64_t)last_idx >> (6 * __lvl)))
+        break;
+      if (!__lvl)
+        return __idx;
+
+      /* Descend into the first word below marked as non-empty. */
+      --__lvl;
+      __idx <<= 6;
+    } else {
+      /*
+       * Ascend to search the next word; This also skips the stale summary bit
+       * which may be observed with the atomic variants.
+       */
+      if (++__lvl == hier->nr_levels)
+        break;
+      __idx = (__idx >> 6) + 1;
     }
-    ++__tmp;
   }
   return -1;
 }
+
+/* Lock-free ID allocator */
+
+void bitset_idalloc_init(struct bitset_idalloc *restrict idalloc,
+                         bitset_t *restrict bitset, uint32_t nr_bits,
+                         struct bitset_idalloc_hint *restrict hints,
+                         uint32_t nr_hints) {
+  __builtin_memset(bitset, 0, BITSET_SIZE(nr_bits));
+  if (likely(nr_bits))
+    bitset_set_range(bitset, 0, nr_bits - 1);
+
+  idalloc->bitset = bitset;
+  idalloc->hints = hints;
+  idalloc->nr_bits = nr_bits;
+  idalloc->nr_hints = nr_hints;
+
+  /* Spread the initial hints over the words. */
+  for (uint32_t __i = 0; __i < nr_hints; ++__i)
+    (hints + __i)->idx = ((uint64_t)nr_bits * __i / nr_hints) & -0x40;
+}
+
+static __always_inline struct bitset_idalloc_hint *
+_bitset_idalloc_hint(const struct bitset_idalloc *restrict idalloc) {
+  if (idalloc->nr_hints == 1)
+    return idalloc->hints;
+#ifndef __KERNEL__
+  const int __cpu = sched_getcpu();
+  return idalloc->hints + (unlikely(__cpu == -1)
+                               ? 0
+                               : ((uint32_t)__cpu & (idalloc->nr_hints - 1)));
+#else
+  return idalloc->hints + (raw_smp_processor_id() & (idalloc->nr_hints - 1));
+#endif
+}
+
+static int32_t _bitset_idalloc_claim(struct bitset_idalloc *restrict idalloc,
+                                     uint32_t start_idx, uint32_t last_idx) {
+  int32_t __idx;
+  while ((__idx = bitset_search_lowest((const bitset_t *)idalloc->bitset,
+                                       start_idx, last_idx)) != -1) {
+    /* LOCK BTR; Lost the race if the bit has been already cleared. */
+    if (likely(bitset_unset_atomic(idalloc->bitset, __idx)))
+      return __idx;
+    start_idx = __idx;
+  }
+  return -1;
+}
+int32_t bitset_idalloc_get(struct bitset_idalloc *restrict idalloc) {
+  struct bitset_idalloc_hint *const restrict __hint =
+      _bitset_idalloc_hint(idalloc);
+  uint32_t __start_idx = __hint->idx;
+  if (unlikely(__start_idx >= idalloc->nr_bits))
+    __start_idx = 0;
+
+  int32_t __idx =
+      likely(idalloc->nr_bits)
+          ? _bitset_idalloc_claim(idalloc, __start_idx, idalloc->nr_bits - 1)
+          : -1;
+  if (__idx == -1 && __start_idx)
+    /* Wrap around. */
+    __idx = _bitset_idalloc_claim(idalloc, 0, __start_idx - 1);
+
+  if (likely(__idx != -1))
+    __hint->idx = __idx + 1;
+  return __idx;
+}
+void bitset_idalloc_put(struct bitset_idalloc *restrict idalloc,
+                        uint32_t idx) {
+  bitset_set_atomic(idalloc->bitset, idx);
+  _bitset_idalloc_hint(idalloc)->idx = idx;
+}
+
+static uint32_t
+_bitset_idalloc_claim_batch(struct bitset_idalloc *restrict idalloc,
+                            uint32_t *restrict idxs, uint32_t nr,
+                            uint32_t start_idx, uint32_t last_idx) {
+  uint32_t __nr_got = 0;
+  int32_t __idx;
+  while (__nr_got < nr &&
+         (__idx = bitset_search_lowest((const bitset_t *)idalloc->bitset,
+                                       start_idx, last_idx)) != -1) {
+    volatile bitset_t *const restrict __word = idalloc->bitset + (__idx >> 6);
+
+    /* Claim the lowest bits of the word as many as needed at once. */
+    bitset_t __old = *__word, __claim, __cur;
+    do {
+      bitset_t __avail = __old;
+      __claim = 0;
+      for (uint32_t __i = __nr_got; __avail && __i < nr; ++__i) {
+        __claim |= __avail & -__avail;
+        __avail &= __avail - 1;
+      }
+      if (unlikely(!__claim))
+        break;
+    } while (unlikely((__cur = __sync_val_compare_and_swap(
+                           __word, __old, __old & ~__claim)) != __old) &&
+             ((__old = __cur), 1));
+
+    for (; __claim; __claim &= __claim - 1)
+      *(idxs + __nr_got++) = (__idx & -0x40) + __builtin_ctzll(__claim);
+
+    start_idx = (__idx & -0x40) + 0x40;
+    if (unlikely(start_idx > last_idx || !start_idx))
+      break;
+  }
+  return __nr_got;
+}
+uint32_t bitset_idalloc_get_batch(struct bitset_idalloc *restrict idalloc,
+                                  uint32_t *restrict idxs, uint32_t nr) {
+  if (unlikely(!nr || !idalloc->nr_bits))
+    return 0;
+
+  struct bitset_idalloc_hint *const restrict __hint =
+      _bitset_idalloc_hint(idalloc);
+  uint32_t __start_idx = __hint->idx;
+  if (unlikely(__start_idx >= idalloc->nr_bits))
+    __start_idx = 0;
+
+  uint32_t __nr_got = _bitset_idalloc_claim_batch(
+      idalloc, idxs, nr, __start_idx, idalloc->nr_bits - 1);
+  if (__nr_got < nr && __start_idx)
+    /* Wrap around. */
+    __nr_got += _bitset_idalloc_claim_batch(idalloc, idxs + __nr_got,
+                                            nr - __nr_got, 0, __start_idx - 1);
+
+  if (likely(__nr_got))
+    __hint->idx = *(idxs + __nr_got - 1) + 1;
+  return __nr_got;
+}
+void bitset_idalloc_put_batch(struct bitset_idalloc *restrict idalloc,
+                              const uint32_t *restrict idxs, uint32_t nr) {
+  if (unlikely(!nr))
+    return;
+
+  for (uint32_t __i = 0; __i < nr;) {
+    const uint32_t __word_idx = *(idxs + __i) >> 6;
+    bitset_t __mask = 0;
+    for (; __i < nr && (*(idxs + __i) >> 6) == __word_idx; ++__i)
+      __mask |= 1ull << (*(idxs + __i) & 0x3F);
+    __sync_fetch_and_or(idalloc->bitset + __word_idx, __mask);
+  }
+  _bitset_idalloc_hint(idalloc)->idx = *idxs;
+}
+
+#ifndef __KERNEL__
+
+/* Persistent bitset file */
+
+int bitset_file_open(struct bitset_file *restrict file,
+                     const char *restrict path, uint64_t nr_bits, int oflag,
+                     mode_t mode) {
+  const int __fd = open(path, oflag, mode);
+  if (__fd == -1)
+    return -1;
+
+  struct stat __st;
+  if (fstat(__fd, &__st) == -1)
+    goto err_close;
+
+  struct bitset_file_header __header;
+  const int __create = !__st.st_size;
+  if (__create) {
+    /* Create the new file with the given number of bits. */
+    if (!nr_bits || (oflag & O_ACCMODE) == O_RDONLY) {
+      errno = !nr_bits ? EINVAL : EBADF;
+      goto err_close;
+    }
+    __header = (struct bitset_file_header){
+        .magic = BITSET_FILE_MAGIC,
+        .version = BITSET_FILE_VERSION,
+        .header_size = BITSET_FILE_HEADER_SIZE,
+        .nr_bits = nr_bits,
+    };
+    if (ftruncate(__fd, __header.header_size + BITSET_SIZE(nr_bits)) == -1)
+      goto err_close;
+  } else {
+    /* Validate the existing file. */
+    if (pread(__fd, &__header, sizeof(__header), 0) != sizeof(__header) ||
+        __header.magic != BITSET_FILE_MAGIC ||
+        __header.version != BITSET_FILE_VERSION ||
+        __header.header_size < sizeof(__header) ||
+        __header.header_size % PAGE_SIZE ||
+        (nr_bits && nr_bits != __header.nr_bits) ||
+        (uint64_t)__st.st_size <
+            __header.header_size + BITSET_SIZE(__header.nr_bits)) {
+      errno = EINVAL;
+      goto err_close;
+    }
+  }
+
+  const size_t __size = __header.header_size + BITSET_SIZE(__header.nr_bits);
+  void *const __addr =
+      mmap(NULL, __size,
+           (oflag & O_ACCMODE) == O_RDONLY ? PROT_READ : PROT_READ | PROT_WRITE,
+           MAP_SHARED, __fd, 0);
+  if (__addr == MAP_FAILED)
+    goto err_close;
+
+  /* Write the header last so that the partially created file is invalid. */
+  if (__create)
+    *(struct bitset_file_header *)__addr = __header;
+
+  file->header = __addr;
+  file->bitset = __addr + __header.header_size;
+  file->nr_bits = __header.nr_bits;
+  file->size = __size;
+  file->fd = __fd;
+  return 0;
+
+err_close:;
+  const int __errno = errno;
+  close(__fd);
+  errno = __errno;
+  return -1;
+}
+int bitset_file_sync(const struct bitset_file *restrict file, int async) {
+  return msync(file->header, file->size, async ? MS_ASYNC : MS_SYNC);
+}
+int bitset_file_close(struct bitset_file *restrict file) {
+  if (munmap(file->header, file->size) == -1)
+    return -1;
+  return close(file->fd);
+}
+
+#endif
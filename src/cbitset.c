@@ -0,0 +1,660 @@
+#include "x86linux/helper.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CBITSET_CHUNK_LEN BITSET_LEN(CBITSET_CHUNK_BITS)
+
+/* Containers */
+
+static void _cbitset_container_free(struct cbitset_container *restrict c) {
+  free(c->array); // Same address for all types
+  c->array = NULL;
+  c->card = c->nr = c->cap = 0;
+}
+
+/* Return the position of the first element >= `low` in the array. */
+static uint32_t _cbitset_array_lower_bound(const uint16_t *restrict array,
+                                           uint32_t nr, uint16_t low) {
+  uint32_t __lo = 0, __hi = nr;
+  while (__lo < __hi) {
+    const uint32_t __mid = (__lo + __hi) / 2;
+    if (*(array + __mid) < low)
+      __lo = __mid + 1;
+    else
+      __hi = __mid;
+  }
+  return __lo;
+}
+/* Return the position of the first run which ends at or after `low`. */
+static uint32_t
+_cbitset_run_lower_bound(const struct cbitset_run *restrict runs, uint32_t nr,
+                         uint16_t low) {
+  uint32_t __lo = 0, __hi = nr;
+  while (__lo < __hi) {
+    const uint32_t __mid = (__lo + __hi) / 2;
+    if ((uint32_t)(runs + __mid)->start + (runs + __mid)->len < low)
+      __lo = __mid + 1;
+    else
+      __hi = __mid;
+  }
+  return __lo;
+}
+
+static int _cbitset_container_test(const struct cbitset_container *restrict c,
+                                   uint16_t low) {
+  switch (c->type) {
+  case CBITSET_ARRAY: {
+    const uint32_t __pos = _cbitset_array_lower_bound(c->array, c->nr, low);
+    return __pos < c->nr && *(c->array + __pos) == low;
+  }
+  case CBITSET_BITMAP:
+    return bitset_test(c->bitmap, low);
+  default: {
+    const uint32_t __pos = _cbitset_run_lower_bound(c->runs, c->nr, low);
+    return __pos < c->nr && (c->runs + __pos)->start <= low;
+  }
+  }
+}
+
+/* Fill `bitmap` (CBITSET_CHUNK_LEN words) with the container. */
+static void _cbitset_container_to_bitmap(const struct cbitset_container *c,
+                                         bitset_t *restrict bitmap) {
+  switch (c->type) {
+  case CBITSET_ARRAY:
+    memset(bitmap, 0, BITSET_SIZE(CBITSET_CHUNK_BITS));
+    for (uint32_t __i = 0; __i < c->nr; ++__i)
+      bitset_set(bitmap, *(c->array + __i));
+    break;
+  case CBITSET_BITMAP:
+    memcpy(bitmap, c->bitmap, BITSET_SIZE(CBITSET_CHUNK_BITS));
+    break;
+  default:
+    memset(bitmap, 0, BITSET_SIZE(CBITSET_CHUNK_BITS));
+    for (uint32_t __i = 0; __i < c->nr; ++__i)
+      bitset_set_range(bitmap, (c->runs + __i)->start,
+                       (c->runs + __i)->start + (c->runs + __i)->len);
+    break;
+  }
+}
+
+/* Replace the container with the bitmap one. */
+static int _cbitset_container_to_bitmap_type(struct cbitset_container *c) {
+  bitset_t *const restrict __bitmap = malloc(BITSET_SIZE(CBITSET_CHUNK_BITS));
+  if (unlikely(!__bitmap))
+    return -1;
+  _cbitset_container_to_bitmap(c, __bitmap);
+
+  const uint32_t __card = c->card;
+  _cbitset_container_free(c);
+  c->bitmap = __bitmap;
+  c->card = __card;
+  c->type = CBITSET_BITMAP;
+  return 0;
+}
+/* Replace the container (of `card` <= CBITSET_ARRAY_MAX) with the array one. */
+static int _cbitset_container_to_array_type(struct cbitset_container *c) {
+  uint16_t *const restrict __array =
+      malloc(sizeof(*__array) * (c->card ? c->card : 1));
+  if (unlikely(!__array))
+    return -1;
+
+  uint32_t __nr = 0;
+  if (c->type == CBITSET_BITMAP) {
+    uint32_t __idxs[CBITSET_ARRAY_MAX];
+    __nr = bitset_extract(c->bitmap, 0, CBITSET_CHUNK_BITS - 1, __idxs,
+                          CBITSET_ARRAY_MAX);
+    for (uint32_t __i = 0; __i < __nr; ++__i)
+      *(__array + __i) = *(__idxs + __i);
+  } else
+    for (uint32_t __i = 0; __i < c->nr; ++__i)
+      for (uint32_t __low = (c->runs + __i)->start;
+           __low <= (uint32_t)(c->runs + __i)->start + (c->runs + __i)->len;
+           ++__low)
+        *(__array + __nr++) = __low;
+
+  _cbitset_container_free(c);
+  c->array = __array;
+  c->card = c->nr = c->cap = __nr;
+  c->type = CBITSET_ARRAY;
+  return 0;
+}
+/* Expand the run container to be mutable. */
+static int _cbitset_container_expand(struct cbitset_container *c) {
+  if (c->type != CBITSET_RUN)
+    return 0;
+  return c->card > CBITSET_ARRAY_MAX ? _cbitset_container_to_bitmap_type(c)
+                                     : _cbitset_container_to_array_type(c);
+}
+
+static int
+_cbitset_container_clone(struct cbitset_container *restrict dest,
+                         const struct cbitset_container *restrict c) {
+  const size_t __size =
+      c->type == CBITSET_BITMAP ? BITSET_SIZE(CBITSET_CHUNK_BITS)
+      : c->type == CBITSET_ARRAY
+          ? sizeof(*c->array) * c->nr
+          : sizeof(*c->runs) * c->nr;
+  *dest = *c;
+  if (unlikely(!(dest->array = malloc(__size ? __size : 1))))
+    return -1;
+  memcpy(dest->array, c->array, __size);
+  dest->cap = c->type == CBITSET_BITMAP ? 0 : c->nr;
+  return 0;
+}
+
+/* Set of containers */
+
+/* Return the position of the container of `key`, or where to insert it. */
+static uint32_t _cbitset_lower_bound(const struct cbitset *restrict cb,
+                                     uint16_t key) {
+  uint32_t __lo = 0, __hi = cb->nr;
+  while (__lo < __hi) {
+    const uint32_t __mid = (__lo + __hi) / 2;
+    if ((cb->containers + __mid)->key < key)
+      __lo = __mid + 1;
+    else
+      __hi = __mid;
+  }
+  return __lo;
+}
+
+static struct cbitset_container *
+_cbitset_insert(struct cbitset *restrict cb, uint32_t pos, uint16_t key) {
+  if (cb->nr == cb->cap) {
+    const uint32_t __cap = cb->cap ? cb->cap * 2 : 4;
+    struct cbitset_container *const restrict __containers =
+        realloc(cb->containers, sizeof(*__containers) * __cap);
+    if (unlikely(!__containers))
+      return NULL;
+    cb->containers = __containers;
+    cb->cap = __cap;
+  }
+  memmove(cb->containers + pos + 1, cb->containers + pos,
+          sizeof(*cb->containers) * (cb->nr - pos));
+  ++cb->nr;
+
+  struct cbitset_container *const restrict __c = cb->containers + pos;
+  *__c = (struct cbitset_container){.key = key, .type = CBITSET_ARRAY};
+  return __c;
+}
+static void _cbitset_remove(struct cbitset *restrict cb, uint32_t pos) {
+  _cbitset_container_free(cb->containers + pos);
+  memmove(cb->containers + pos, cb->containers + pos + 1,
+          sizeof(*cb->containers) * (cb->nr - pos - 1));
+  --cb->nr;
+}
+/* Append the (non-empty) container while building the result. */
+static int _cbitset_append(struct cbitset *restrict cb,
+                           struct cbitset_container *restrict c) {
+  if (!c->card) {
+    _cbitset_container_free(c);
+    return 0;
+  }
+  struct cbitset_container *const restrict __c =
+      _cbitset_insert(cb, cb->nr, c->key);
+  if (unlikely(!__c)) {
+    _cbitset_container_free(c);
+    return -1;
+  }
+  *__c = *c;
+  return 0;
+}
+
+void cbitset_init(struct cbitset *restrict cb) {
+  cb->containers = NULL;
+  cb->nr = cb->cap = 0;
+}
+void cbitset_deinit(struct cbitset *restrict cb) {
+  for (uint32_t __i = 0; __i < cb->nr; ++__i)
+    _cbitset_container_free(cb->containers + __i);
+  free(cb->containers);
+  cbitset_init(cb);
+}
+
+int cbitset_test(const struct cbitset *restrict cb, uint32_t idx) {
+  const uint32_t __pos = _cbitset_lower_bound(cb, idx >> 16);
+  return __pos < cb->nr && (cb->containers + __pos)->key == (idx >> 16) &&
+         _cbitset_container_test(cb->containers + __pos, idx);
+}
+
+int cbitset_set(struct cbitset *restrict cb, uint32_t idx) {
+  const uint16_t __low = idx;
+  const uint32_t __pos = _cbitset_lower_bound(cb, idx >> 16);
+  struct cbitset_container *restrict __c = cb->containers + __pos;
+  if (__pos == cb->nr || __c->key != (idx >> 16)) {
+    if (unlikely(!(__c = _cbitset_insert(cb, __pos, idx >> 16))))
+      return -1;
+  } else if (_cbitset_container_test(__c, __low))
+    return 1;
+
+  if (unlikely(_cbitset_container_expand(__c)))
+    goto err;
+
+  if (__c->type == CBITSET_ARRAY && __c->card == CBITSET_ARRAY_MAX &&
+      unlikely(_cbitset_container_to_bitmap_type(__c)))
+    goto err;
+
+  if (__c->type == CBITSET_BITMAP)
+    bitset_set(__c->bitmap, __low);
+  else {
+    if (__c->nr == __c->cap) {
+      const uint32_t __cap = __c->cap ? __c->cap * 2 : 4;
+      uint16_t *const restrict __array =
+          realloc(__c->array, sizeof(*__array) * __cap);
+      if (unlikely(!__array))
+        goto err;
+      __c->array = __array;
+      __c->cap = __cap;
+    }
+    const uint32_t __i = _cbitset_array_lower_bound(__c->array, __c->nr, __low);
+    memmove(__c->array + __i + 1, __c->array + __i,
+            sizeof(*__c->array) * (__c->nr - __i));
+    *(__c->array + __i) = __low;
+    ++__c->nr;
+  }
+  ++__c->card;
+  return 0;
+
+err:
+  /* Do not leave the new empty container. */
+  if (!__c->card)
+    _cbitset_remove(cb, __c - cb->containers);
+  return -1;
+}
+int cbitset_unset(struct cbitset *restrict cb, uint32_t idx) {
+  const uint16_t __low = idx;
+  const uint32_t __pos = _cbitset_lower_bound(cb, idx >> 16);
+  struct cbitset_container *const restrict __c = cb->containers + __pos;
+  if (__pos == cb->nr || __c->key != (idx >> 16) ||
+      !_cbitset_container_test(__c, __low))
+    return 0;
+
+  if (unlikely(_cbitset_container_expand(__c)))
+    return -1;
+
+  if (__c->type == CBITSET_BITMAP) {
+    bitset_unset(__c->bitmap, __low);
+    if (--__c->card == CBITSET_ARRAY_MAX &&
+        unlikely(_cbitset_container_to_array_type(__c)))
+      return -1;
+  } else {
+    const uint32_t __i = _cbitset_array_lower_bound(__c->array, __c->nr, __low);
+    memmove(__c->array + __i, __c->array + __i + 1,
+            sizeof(*__c->array) * (__c->nr - __i - 1));
+    --__c->nr;
+    --__c->card;
+  }
+
+  if (!__c->card)
+    _cbitset_remove(cb, __pos);
+  return 1;
+}
+
+uint64_t cbitset_count(const struct cbitset *restrict cb) {
+  uint64_t __cnt = 0;
+  for (uint32_t __i = 0; __i < cb->nr; ++__i)
+    __cnt += (cb->containers + __i)->card;
+  return __cnt;
+}
+size_t cbitset_size(const struct cbitset *restrict cb) {
+  size_t __size = sizeof(*cb->containers) * cb->cap;
+  for (uint32_t __i = 0; __i < cb->nr; ++__i) {
+    const struct cbitset_container *const restrict __c = cb->containers + __i;
+    __size += __c->type == CBITSET_BITMAP ? BITSET_SIZE(CBITSET_CHUNK_BITS)
+              : __c->type == CBITSET_ARRAY
+                  ? sizeof(*__c->array) * __c->cap
+                  : sizeof(*__c->runs) * __c->cap;
+  }
+  return __size;
+}
+
+/* Iteration */
+
+int64_t cbitset_search_lowest(const struct cbitset *restrict cb,
+                              uint32_t start_idx) {
+  for (uint32_t __pos = _cbitset_lower_bound(cb, start_idx >> 16);
+       __pos < cb->nr; ++__pos) {
+    const struct cbitset_container *const restrict __c =
+        cb->containers + __pos;
+    const uint16_t __low = __c->key == (start_idx >> 16) ? start_idx : 0;
+
+    int32_t __res = -1;
+    switch (__c->type) {
+    case CBITSET_ARRAY: {
+      const uint32_t __i =
+          _cbitset_array_lower_bound(__c->array, __c->nr, __low);
+      if (__i < __c->nr)
+        __res = *(__c->array + __i);
+      break;
+    }
+    case CBITSET_BITMAP:
+      __res = bitset_search_lowest(__c->bitmap, __low, CBITSET_CHUNK_BITS - 1);
+      break;
+    default: {
+      const uint32_t __i = _cbitset_run_lower_bound(__c->runs, __c->nr, __low);
+      if (__i < __c->nr)
+        __res = (__c->runs + __i)->start > __low ? (__c->runs + __i)->start
+                                                 : __low;
+      break;
+    }
+    }
+    if (__res != -1)
+      return ((uint32_t)__c->key << 16) | __res;
+  }
+  return -1;
+}
+
+uint32_t cbitset_extract(const struct cbitset *restrict cb, uint32_t start_idx,
+                         uint32_t *restrict idxs, uint32_t nr) {
+  uint32_t __nr = 0;
+  for (uint32_t __pos = _cbitset_lower_bound(cb, start_idx >> 16);
+       __pos < cb->nr && __nr < nr; ++__pos) {
+    const struct cbitset_container *const restrict __c =
+        cb->containers + __pos;
+    const uint16_t __low = __c->key == (start_idx >> 16) ? start_idx : 0;
+    const uint32_t __base = (uint32_t)__c->key << 16;
+
+    switch (__c->type) {
+    case CBITSET_ARRAY:
+      for (uint32_t __i =
+               _cbitset_array_lower_bound(__c->array, __c->nr, __low);
+           __i < __c->nr && __nr < nr; ++__i)
+        *(idxs + __nr++) = __base | *(__c->array + __i);
+      break;
+    case CBITSET_BITMAP: {
+      /* Reuse the dense kernel, then rebase. */
+      const uint32_t __cnt = bitset_extract(
+          __c->bitmap, __low, CBITSET_CHUNK_BITS - 1, idxs + __nr, nr - __nr);
+      for (uint32_t __i = 0; __i < __cnt; ++__i)
+        *(idxs + __nr + __i) |= __base;
+      __nr += __cnt;
+      break;
+    }
+    default:
+      for (uint32_t __i = _cbitset_run_lower_bound(__c->runs, __c->nr, __low);
+           __i < __c->nr && __nr < nr; ++__i) {
+        const struct cbitset_run *const restrict __run = __c->runs + __i;
+        for (uint32_t __idx = __run->start > __low ? __run->start : __low;
+             __idx <= (uint32_t)__run->start + __run->len && __nr < nr;
+             ++__idx)
+          *(idxs + __nr++) = __base | __idx;
+      }
+      break;
+    }
+  }
+  return __nr;
+}
+
+/* Intersection and union */
+
+/* Return the position of the first element >= `low` from `pos` (galloping). */
+static uint32_t _cbitset_array_gallop(const uint16_t *restrict array,
+                                      uint32_t pos, uint32_t nr,
+                                      uint16_t low) {
+  uint32_t __step = 1, __hi = pos;
+  while (__hi < nr && *(array + __hi) < low) {
+    pos = __hi + 1;
+    __hi += __step;
+    __step *= 2;
+  }
+  if (__hi > nr)
+    __hi = nr;
+  return pos + _cbitset_array_lower_bound(array + pos, __hi - pos, low);
+}
+
+static int _cbitset_container_and(struct cbitset_container *restrict dest,
+                                  const struct cbitset_container *x,
+                                  const struct cbitset_container *y) {
+  bitset_t __bitmap_x[CBITSET_CHUNK_LEN], __bitmap_y[CBITSET_CHUNK_LEN];
+  *dest = (struct cbitset_container){.key = x->key, .type = CBITSET_ARRAY};
+
+  /* Let `x` be the array one if there is. */
+  if (y->type == CBITSET_ARRAY) {
+    const struct cbitset_container *const __tmp = x;
+    x = y;
+    y = __tmp;
+  }
+
+  if (x->type == CBITSET_ARRAY) {
+    if (unlikely(!(dest->array = malloc(sizeof(*dest->array) * x->nr))))
+      return -1;
+    dest->cap = x->nr;
+
+    if (y->type == CBITSET_ARRAY) {
+      /* Gallop over the larger array for the smaller one. */
+      if (x->nr > y->nr) {
+        const struct cbitset_container *const __tmp = x;
+        x = y;
+        y = __tmp;
+      }
+      for (uint32_t __i = 0, __j = 0; __i < x->nr && __j < y->nr; ++__i) {
+        __j = _cbitset_array_gallop(y->array, __j, y->nr, *(x->array + __i));
+        if (__j < y->nr && *(y->array + __j) == *(x->array + __i))
+          *(dest->array + dest->nr++) = *(x->array + __i);
+      }
+    } else {
+      const bitset_t *restrict __bitmap = y->bitmap;
+      if (y->type == CBITSET_RUN) {
+        _cbitset_container_to_bitmap(y, __bitmap_y);
+        __bitmap = __bitmap_y;
+      }
+      for (uint32_t __i = 0; __i < x->nr; ++__i)
+        if (bitset_test(__bitmap, *(x->array + __i)))
+          *(dest->array + dest->nr++) = *(x->array + __i);
+    }
+    dest->card = dest->nr;
+    return 0;
+  }
+
+  /* Both are bitmap (or run) ones; Use the dense kernels. */
+  _cbitset_container_to_bitmap(x, __bitmap_x);
+  const bitset_t *restrict __bitmap = y->bitmap;
+  if (y->type == CBITSET_RUN) {
+    _cbitset_container_to_bitmap(y, __bitmap_y);
+    __bitmap = __bitmap_y;
+  }
+  bitset_and(__bitmap_x, __bitmap, 0, CBITSET_CHUNK_BITS - 1);
+  dest->card = bitset_count(__bitmap_x, 0, CBITSET_CHUNK_BITS - 1);
+  if (!dest->card)
+    return 0;
+
+  dest->type = CBITSET_BITMAP;
+  if (unlikely(!(dest->bitmap = malloc(BITSET_SIZE(CBITSET_CHUNK_BITS)))))
+    return -1;
+  memcpy(dest->bitmap, __bitmap_x, BITSET_SIZE(CBITSET_CHUNK_BITS));
+  if (dest->card <= CBITSET_ARRAY_MAX &&
+      unlikely(_cbitset_container_to_array_type(dest))) {
+    _cbitset_container_free(dest); // Not owned by the caller on failure
+    return -1;
+  }
+  return 0;
+}
+static int _cbitset_container_or(struct cbitset_container *restrict dest,
+                                 const struct cbitset_container *x,
+                                 const struct cbitset_container *y) {
+  *dest = (struct cbitset_container){.key = x->key, .type = CBITSET_ARRAY};
+
+  if (x->type == CBITSET_ARRAY && y->type == CBITSET_ARRAY &&
+      x->nr + y->nr <= CBITSET_ARRAY_MAX) {
+    if (unlikely(!(dest->array =
+                       malloc(sizeof(*dest->array) * (x->nr + y->nr)))))
+      return -1;
+    dest->cap = x->nr + y->nr;
+
+    uint32_t __i = 0, __j = 0;
+    while (__i < x->nr || __j < y->nr) {
+      const uint16_t __a = __i < x->nr ? *(x->array + __i) : UINT16_MAX;
+      const uint16_t __b = __j < y->nr ? *(y->array + __j) : UINT16_MAX;
+      if (__j == y->nr || (__i < x->nr && __a < __b))
+        *(dest->array + dest->nr++) = __a, ++__i;
+      else if (__i == x->nr || __b < __a)
+        *(dest->array + dest->nr++) = __b, ++__j;
+      else
+        *(dest->array + dest->nr++) = __a, ++__i, ++__j;
+    }
+    dest->card = dest->nr;
+    return 0;
+  }
+
+  /* Use the dense kernels. */
+  dest->type = CBITSET_BITMAP;
+  if (unlikely(!(dest->bitmap = malloc(BITSET_SIZE(CBITSET_CHUNK_BITS)))))
+    return -1;
+  _cbitset_container_to_bitmap(x, dest->bitmap);
+  if (y->type == CBITSET_ARRAY)
+    for (uint32_t __i = 0; __i < y->nr; ++__i)
+      bitset_set(dest->bitmap, *(y->array + __i));
+  else if (y->type == CBITSET_RUN)
+    for (uint32_t __i = 0; __i < y->nr; ++__i)
+      bitset_set_range(dest->bitmap, (y->runs + __i)->start,
+                       (y->runs + __i)->start + (y->runs + __i)->len);
+  else
+    bitset_or(dest->bitmap, y->bitmap, 0, CBITSET_CHUNK_BITS - 1);
+  dest->card = bitset_count(dest->bitmap, 0, CBITSET_CHUNK_BITS - 1);
+  if (dest->card <= CBITSET_ARRAY_MAX &&
+      unlikely(_cbitset_container_to_array_type(dest))) {
+    _cbitset_container_free(dest); // Not owned by the caller on failure
+    return -1;
+  }
+  return 0;
+}
+
+int cbitset_and(struct cbitset *restrict dest, const struct cbitset *a,
+                const struct cbitset *b) {
+  cbitset_deinit(dest);
+
+  uint32_t __i = 0, __j = 0;
+  while (__i < a->nr && __j < b->nr) {
+    const struct cbitset_container *const __x = a->containers + __i,
+                                          *const __y = b->containers + __j;
+    if (__x->key < __y->key)
+      ++__i;
+    else if (__y->key < __x->key)
+      ++__j;
+    else {
+      struct cbitset_container __c;
+      if (unlikely(_cbitset_container_and(&__c, __x, __y)) ||
+          unlikely(_cbitset_append(dest, &__c)))
+        goto err;
+      ++__i, ++__j;
+    }
+  }
+  return 0;
+
+err:
+  cbitset_deinit(dest);
+  errno = ENOMEM;
+  return -1;
+}
+int cbitset_or(struct cbitset *restrict dest, const struct cbitset *a,
+               const struct cbitset *b) {
+  cbitset_deinit(dest);
+
+  uint32_t __i = 0, __j = 0;
+  while (__i < a->nr || __j < b->nr) {
+    const struct cbitset_container *const __x =
+        __i < a->nr ? a->containers + __i : NULL;
+    const struct cbitset_container *const __y =
+        __j < b->nr ? b->containers + __j : NULL;
+
+    struct cbitset_container __c;
+    int __ret;
+    if (!__y || (__x && __x->key < __y->key))
+      __ret = _cbitset_container_clone(&__c, __x), ++__i;
+    else if (!__x || __y->key < __x->key)
+      __ret = _cbitset_container_clone(&__c, __y), ++__j;
+    else
+      __ret = _cbitset_container_or(&__c, __x, __y), ++__i, ++__j;
+    if (unlikely(__ret) || unlikely(_cbitset_append(dest, &__c)))
+      goto err;
+  }
+  return 0;
+
+err:
+  cbitset_deinit(dest);
+  errno = ENOMEM;
+  return -1;
+}
+
+/* Compression */
+
+static uint32_t
+_cbitset_container_nr_runs(const struct cbitset_container *restrict c) {
+  uint32_t __nr = 0;
+  if (c->type == CBITSET_ARRAY) {
+    for (uint32_t __i = 0; __i < c->nr; ++__i)
+      __nr += !__i || *(c->array + __i) != *(c->array + __i - 1) + 1;
+  } else {
+    /* Count the first bit of each run. */
+    bitset_t __carry = 0;
+    for (uint32_t __i = 0; __i < CBITSET_CHUNK_LEN; ++__i) {
+      const bitset_t __w = *(c->bitmap + __i);
+      __nr += __builtin_popcountll(__w & ~((__w << 1) | __carry));
+      __carry = __w >> 63;
+    }
+  }
+  return __nr;
+}
+static int _cbitset_container_to_run_type(struct cbitset_container *c,
+                                          uint32_t nr_runs) {
+  struct cbitset_run *const restrict __runs =
+      malloc(sizeof(*__runs) * nr_runs);
+  if (unlikely(!__runs))
+    return -1;
+
+  uint32_t __nr = 0;
+  if (c->type == CBITSET_ARRAY) {
+    for (uint32_t __i = 0; __i < c->nr; ++__i)
+      if (__nr && *(c->array + __i) ==
+                      (__runs + __nr - 1)->start + (__runs + __nr - 1)->len + 1)
+        ++(__runs + __nr - 1)->len;
+      else
+        *(__runs + __nr++) =
+            (struct cbitset_run){.start = *(c->array + __i), .len = 0};
+  } else {
+    /* Alternate the set and unset bit searches to find the edges. */
+    int32_t __start =
+        bitset_search_lowest(c->bitmap, 0, CBITSET_CHUNK_BITS - 1);
+    while (__start != -1) {
+      int32_t __end = bitset_search_lowest_zero(c->bitmap, __start,
+                                                CBITSET_CHUNK_BITS - 1);
+      if (__end == -1)
+        __end = CBITSET_CHUNK_BITS;
+      *(__runs + __nr++) =
+          (struct cbitset_run){.start = __start, .len = __end - __start - 1};
+      __start = __end == CBITSET_CHUNK_BITS
+                    ? -1
+                    : bitset_search_lowest(c->bitmap, __end,
+                                           CBITSET_CHUNK_BITS - 1);
+    }
+  }
+
+  const uint32_t __card = c->card;
+  _cbitset_container_free(c);
+  c->runs = __runs;
+  c->card = __card;
+  c->nr = c->cap = __nr;
+  c->type = CBITSET_RUN;
+  return 0;
+}
+int cbitset_optimize(struct cbitset *restrict cb) {
+  for (uint32_t __i = 0; __i < cb->nr; ++__i) {
+    struct cbitset_container *const restrict __c = cb->containers + __i;
+    if (__c->type == CBITSET_RUN)
+      continue;
+
+    /* Convert to the run one only if it gets smaller. */
+    const uint32_t __nr_runs = _cbitset_container_nr_runs(__c);
+    const size_t __size = __c->type == CBITSET_BITMAP
+                              ? BITSET_SIZE(CBITSET_CHUNK_BITS)
+                              : sizeof(*__c->array) * __c->card;
+    if (sizeof(*__c->runs) * __nr_runs < __size &&
+        unlikely(_cbitset_container_to_run_type(__c, __nr_runs))) {
+      errno = ENOMEM;
+      return -1;
+    }
+  }
+  return 0;
+}
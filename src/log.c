@@ -3,12 +3,18 @@
 #ifndef __KERNEL__
 
 #include <errno.h>
+#include <printf.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include <dlfcn.h>
+#include <pthread.h>
+#include <syscall.h>
+#include <unistd.h>
 
 #include <sys/mman.h>
+#include <sys/uio.h>
 
 #include <backtrace.h>
 
@@ -40,21 +46,37 @@ static const char _LOG_BACKTRACE_SYSLOG_FMT_OFFSET[] =
     " %s%s+0x%lx(%s:%d) [0x%lx]\e[0m";
 static const char _LOG_BACKTRACE_SYSLOG_FMT_UNKNOWN[] =
     " %s%s+?(%s:%d) [0x%lx]\e[0m";
+static const char _LOG_BACKTRACE_STDERR_FMT_RAW[] =
+    " %s%s+0x%lx [0x%lx]\e[0m\n";
+static const char _LOG_BACKTRACE_SYSLOG_FMT_RAW[] = " %s%s+0x%lx [0x%lx]\e[0m";
 
 static const char _LOG_PERROR_ARG[] = "%s (%s)";
 static const char _LOG_PERROR_S_ARG[] = "%s: %s (%s)";
 
-static const char _LOG_STDERR_FMT[] = "%s[%d]: %s%s: %s:%d: %s: %s\e[0m\n";
-static const char _LOG_SYSLOG_FMT[] = "%s%s: %s:%d: %s: %s\e[0m";
+static const char _LOG_STDERR_FMT[] = "%s%s[%d]: %s%s: %s:%d: %s: %s\e[0m\n";
+static const char _LOG_SYSLOG_FMT[] = "%s%s%s: %s:%d: %s: %s\e[0m";
+static const char _LOG_TIMESTAMP_FMT[] = "[%s%lu.%09lu] ";
 
 static char *restrict _progname_copy;
 static const char *restrict _ident;
 static uint64_t *restrict _log_futexp64;
+
+/* Thread ID (cached not to call gettid() for each line) */
+static thread_local pid_t _log_tid;
+static __always_inline pid_t _log_gettid() {
+  if (unlikely(!_log_tid))
+    _log_tid = gettid();
+  return _log_tid;
+}
+/* The forking thread gets another ID in the child. */
+static void _log_tid_reset() { _log_tid = 0; }
+
 static __attribute((constructor(101))) void _log_pre_init() {
   const size_t __size = strlen(program_invocation_short_name) + 1;
   log_verify_error(_progname_copy = malloc(__size));
   strcpy(_progname_copy, program_invocation_short_name);
   _ident = _progname_copy;
+  log_verify_errno(pthread_atfork(NULL, NULL, _log_tid_reset));
 
   const char *const env = getenv("X86LINUX_LOG_LVL");
   if (env) {
@@ -125,53 +147,1285 @@ void _log_assert_perror_fail(const char *restrict filename, int line,
 
 static int _use_syslog;
 
-static int _backtrace_callback(void *data, uintptr_t pc, const char *filepath,
-                               int line, const char *func) {
-  Dl_info __info;
-  dladdr(address_cast(pc), &__info);
-  const void *const __saddr = __info.dli_saddr;
-  const uintptr_t __offset = __saddr ? pc - value_cast(__saddr) : 0;
+enum { _LOG_LINE_MAX = LOG_LINE_MAX * 2 };
+
+/* Timestamp */
+
+enum { _LOG_TIMESTAMP_MAX = 32 };
+
+/* TSC to the wall clock (in ns) with the multiplication and shift only */
+struct _log_tsc_conv {
+  uint64_t tsc_base, ns_base;
+  uint64_t mult;
+  uint32_t shift;
+};
+static void _log_tsc_conv_init(struct _log_tsc_conv *restrict conv,
+                               uint64_t freq_hz, uint64_t tsc_base,
+                               uint64_t ns_base) {
+  conv->tsc_base = tsc_base;
+  conv->ns_base = ns_base;
+  conv->shift = 32;
+  conv->mult = ((__uint128_t)(1000 * 1000 * 1000) << conv->shift) / freq_hz;
+}
+/* Return the TSC at the current CLOCK_REALTIME (in ns). */
+static uint64_t _log_tsc_base(uint64_t *restrict ns) {
+  struct timespec __ts;
+  log_verify_error(clock_gettime(CLOCK_REALTIME, &__ts));
+  const uint64_t __tsc = __rdtsc();
+  *ns = (uint64_t)__ts.tv_sec * 1000 * 1000 * 1000 + __ts.tv_nsec;
+  return __tsc;
+}
+static __always_inline uint64_t
+_log_tsc_to_ns(const struct _log_tsc_conv *restrict conv, int64_t tsc_delta) {
+  return ((__int128_t)tsc_delta * conv->mult) >> conv->shift;
+}
+
+static int _log_ts_mode = LOG_TIMESTAMP_NONE;
+static struct _log_tsc_conv _log_tsc_conv;
+static thread_local uint64_t _log_tsc_prev;
+
+/* Format the timestamp of `tsc` (updating `*prev`); Return `buf`. */
+static const char *_log_timestamp(char *restrict buf,
+                                  const struct _log_tsc_conv *restrict conv,
+                                  uint64_t tsc, uint64_t *restrict prev) {
+  uint64_t __ns;
+  const char *restrict __sign = "";
+  switch (_log_ts_mode) {
+  case LOG_TIMESTAMP_ABS:
+    __ns = conv->ns_base + _log_tsc_to_ns(conv, tsc - conv->tsc_base);
+    break;
+  case LOG_TIMESTAMP_DELTA:
+    /* 0 for the first one (or if the TSC goes backward across cores) */
+    __ns = *prev && (int64_t)(tsc - *prev) > 0
+               ? _log_tsc_to_ns(conv, tsc - *prev)
+               : 0;
+    *prev = tsc;
+    __sign = "+";
+    break;
+  default:
+    *buf = '\0';
+    return buf;
+  }
+  snprintf(buf, _LOG_TIMESTAMP_MAX, _LOG_TIMESTAMP_FMT, __sign,
+           __ns / (1000 * 1000 * 1000), __ns % (1000 * 1000 * 1000));
+  return buf;
+}
+/* Format the timestamp of now (without clock_gettime()). */
+static __always_inline const char *_log_timestamp_now(char *restrict buf) {
+  if (likely(_log_ts_mode == LOG_TIMESTAMP_NONE)) {
+    *buf = '\0';
+    return buf;
+  }
+  return _log_timestamp(buf, &_log_tsc_conv, __rdtsc(), &_log_tsc_prev);
+}
+
+int log_timestamp(int mode) {
+  if (mode != LOG_TIMESTAMP_NONE && mode != LOG_TIMESTAMP_ABS &&
+      mode != LOG_TIMESTAMP_DELTA) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (mode != LOG_TIMESTAMP_NONE) {
+    uint64_t __ns;
+    const uint64_t __tsc = _log_tsc_base(&__ns);
+    _log_tsc_conv_init(&_log_tsc_conv, usersched_tsc_freq_hz, __tsc, __ns);
+  }
+  __atomic_store_n(&_log_ts_mode, mode, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/* Async mode */
+
+struct _log_async_buf {
+  struct spsc_ring ring; // The data follows.
+  struct _log_async_buf *next;
+  int closed; // The owner thread has exited.
+};
+struct _log_async_record {
+  int lvl; // _LOG_ASYNC_BIN for the binary stream
+  /* Including '\0' (which is not written out) if the text */
+  char str[] __attribute((aligned(8)));
+};
+enum {
+  _LOG_ASYNC_RECORD_MAX = sizeof(struct _log_async_record) + _LOG_LINE_MAX,
+  _LOG_ASYNC_IOV_MAX = 64,
+  _LOG_ASYNC_BIN = -1,
+  /* Limit of any record of the binary stream (the entries are far smaller) */
+  _LOG_BIN_RECORD_MAX = 16 * _LOG_LINE_MAX,
+  /* Limit of the descriptor ID (the later ones fall back to the text) */
+  _LOG_BIN_DESCS_MAX = 1 << 16,
+  /* Limit of the width and the precision to decode (beyond the line anyway) */
+  _LOG_BIN_WIDTH_MAX = 2 * _LOG_LINE_MAX,
+  /* `precs` of the descriptor: The fixed one (up to the line) or `*` one */
+  _LOG_BIN_PREC_ARG = 1 << 30, // With the index of the argument
+};
+
+static int _log_async; // Whether log*() uses the async mode
+static int _log_async_policy;
+static uint32_t _log_async_size;
+static uint64_t _log_async_nr_dropped;
+
+/* Per-thread buffers (pushed at the head, and freed only by the writer) */
+static struct _log_async_buf *_log_async_head;
+static thread_local struct _log_async_buf *_log_async_tls;
+static pthread_key_t _log_async_key;
+static pthread_once_t _log_async_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_t _log_async_writer;
+static pthread_mutex_t _log_async_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static int _log_async_running;
+static uint32_t _log_async_event, _log_async_sleeping;
+
+static thread_local int _log_async_exiting;
+
+static void _log_async_exit(void *buf) {
+  /* The writer frees it after closing, so never refer to it again. */
+  _log_async_tls = NULL;
+  _log_async_exiting = 1;
+  __atomic_store_n(&((struct _log_async_buf *)buf)->closed, 1,
+                   __ATOMIC_RELEASE);
+}
+static void _log_async_key_create() {
+  log_verify_errno(pthread_key_create(&_log_async_key, _log_async_exit));
+  /* Write out the pending records also on exit(). */
+  log_verify(!atexit(log_async_stop));
+}
+
+/* Return the buffer of this thread, or NULL (e.g., if exiting). */
+static struct _log_async_buf *_log_async_get() {
+  struct _log_async_buf *restrict __buf = _log_async_tls;
+  if (likely(__buf))
+    return __buf;
+  if (unlikely(_log_async_exiting))
+    return NULL; // The destructor of the key has run already.
+
+  __buf = aligned_alloc(L1_CACHE_BYTES, sizeof(*__buf) + _log_async_size);
+  if (unlikely(!__buf))
+    return NULL;
+  spsc_ring_init(&__buf->ring, sizeof(*__buf), _log_async_size);
+  __buf->closed = 0;
+  pthread_setspecific(_log_async_key, __buf);
+
+  __buf->next = __atomic_load_n(&_log_async_head, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&_log_async_head, &__buf->next, __buf, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  return _log_async_tls = __buf;
+}
+
+/* Wake up the writer (if it sleeps) after publishing. */
+static void _log_async_notify() {
+  /* Pair with the announcement of the writer. */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (likely(!__atomic_load_n(&_log_async_sleeping, __ATOMIC_RELAXED)))
+    return;
+  __atomic_add_fetch(&_log_async_event, 1, __ATOMIC_RELEASE);
+  syscall(SYS_futex, &_log_async_event, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* Return the record of `len` byte(s), or NULL if dropped. */
+static struct _log_async_record *
+_log_async_reserve(struct _log_async_buf *restrict buf, uint32_t len) {
+  struct _log_async_record *restrict __record;
+  while (unlikely(!(__record = spsc_ring_record_reserve(&buf->ring, len)))) {
+    if (_log_async_policy != LOG_ASYNC_BLOCK) {
+      __atomic_add_fetch(&_log_async_nr_dropped, 1, __ATOMIC_RELAXED);
+      return NULL;
+    }
+    _log_async_notify();
+    /* Either contiguous part can hold it then. */
+    spsc_ring_wait_write(&buf->ring, 2 * SPSC_RECORD_SIZE(len),
+                         FUTEX_PRIVATE_FLAG | SA_RESTART,
+                         100 * usersched_tsc_1us, NULL);
+  }
+  return __record;
+}
+static void _log_async_commit(struct _log_async_buf *restrict buf) {
+  struct spsc_ring *const restrict __ring = &buf->ring;
+  spsc_ring_record_commit(__ring);
+  spsc_ring_publish_write(__ring);
+
+  /* The writer polls; Wake it up early only when half full. */
+  const uint32_t __pos_r = __atomic_load_n(&__ring->pos_r, __ATOMIC_RELAXED);
+  const uint32_t __used = __ring->pos_w_next >= __pos_r
+                              ? __ring->pos_w_next - __pos_r
+                              : __ring->size - __pos_r + __ring->pos_w_next;
+  if (unlikely(__used >= __ring->size / 2))
+    _log_async_notify();
+}
+
+static int _log_async_writev(int fd, struct iovec *restrict iov, int nr) {
+  while (nr) {
+    ssize_t __ret = writev(fd, iov, nr);
+    if (unlikely(__ret < 0)) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    for (; nr && (size_t)__ret >= iov->iov_len; ++iov, --nr)
+      __ret -= iov->iov_len;
+    if (nr) {
+      iov->iov_base = (char *)iov->iov_base + __ret;
+      iov->iov_len -= __ret;
+    }
+  }
+  return 0;
+}
+/* Write out the gathered records, then free them for the producers. */
+static void _log_async_flush(int fd, struct iovec *restrict iov,
+                             int *restrict nr_iov,
+                             struct spsc_ring **restrict rings,
+                             int *restrict nr_rings) {
+  _log_async_writev(fd, iov, *nr_iov); // Nowhere to report the error
+
+  for (int __i = 0; __i < *nr_rings; ++__i)
+    spsc_ring_publish_read_wake(rings[__i], FUTEX_PRIVATE_FLAG);
+  *nr_iov = *nr_rings = 0;
+}
+
+/*
+ * Write out the pending records of all buffers (and free the drained ones of
+ * the exited threads); Return the number of them.
+ */
+static int _log_bin_fd = -1;
+static thread_local int _log_async_draining;
+static uint64_t _log_async_drain() {
+  struct iovec __iov[_LOG_ASYNC_IOV_MAX];
+  struct spsc_ring *__rings[_LOG_ASYNC_IOV_MAX];
+  int __nr_iov = 0, __nr_rings = 0, __fd = STDERR_FILENO;
+  uint64_t __nr = 0;
+
+  /* Do not recurse from the failure of itself (e.g., LOG_EMERG). */
+  if (unlikely(_log_async_draining))
+    return 0;
+  _log_async_draining = 1;
+  log_verify_errno(pthread_mutex_lock(&_log_async_drain_lock));
+
+  struct _log_async_buf **__prev = &_log_async_head;
+  struct _log_async_buf *__buf =
+      __atomic_load_n(&_log_async_head, __ATOMIC_ACQUIRE);
+  while (__buf) {
+    /* Check it first; It published all records before closing. */
+    const int __closed = __atomic_load_n(&__buf->closed, __ATOMIC_ACQUIRE);
+    int __gathered = 0;
+
+    const struct _log_async_record *restrict __record;
+    uint32_t __len;
+    while ((__record = spsc_ring_record_peek(&__buf->ring, &__len))) {
+      const int __bin = __record->lvl == _LOG_ASYNC_BIN;
+      if (_use_syslog && !__bin)
+        syslog(__record->lvl, "%s", __record->str);
+      else {
+        /* Keep the order between the text and the binary stream. */
+        const int __record_fd = __bin ? _log_bin_fd : STDERR_FILENO;
+        if (__record_fd != __fd) {
+          _log_async_writev(__fd, __iov, __nr_iov);
+          __nr_iov = 0;
+          __fd = __record_fd;
+        }
+        __iov[__nr_iov++] = (struct iovec){
+            .iov_base = (void *)__record->str,
+            .iov_len = __len - sizeof(*__record) - !__bin,
+        };
+      }
+      if (!__gathered) {
+        __rings[__nr_rings++] = &__buf->ring;
+        __gathered = 1;
+      }
+      spsc_ring_record_release(&__buf->ring);
+      ++__nr;
+
+      if (__nr_iov == _LOG_ASYNC_IOV_MAX || __nr_rings == _LOG_ASYNC_IOV_MAX) {
+        _log_async_flush(__fd, __iov, &__nr_iov, __rings, &__nr_rings);
+        __gathered = 0;
+      }
+    }
+
+    struct _log_async_buf *const __next = __buf->next;
+    /*
+     * The head can be changed by the producers, so leave it to the next pass
+     * (as well as the one which is still referred by `__iov`).
+     */
+    if (__closed && !__gathered && __prev != &_log_async_head) {
+      *__prev = __next;
+      free(__buf);
+    } else
+      __prev = &__buf->next;
+    __buf = __next;
+  }
+  if (__nr_rings)
+    _log_async_flush(__fd, __iov, &__nr_iov, __rings, &__nr_rings);
+
+  log_verify_errno(pthread_mutex_unlock(&_log_async_drain_lock));
+  _log_async_draining = 0;
+  return __nr;
+}
+
+/*
+ * Return 0 on success (including the drop), or -1 to log synchronously after
+ * writing out the pending records; LOG_EMERG (of the abort and the assertion
+ * failure) is never dropped nor left in the buffer.
+ */
+static int _log_async_vlog(int lvl, const char *restrict fmt, va_list ap) {
+  struct _log_async_buf *restrict __buf;
+  if (unlikely(lvl == LOG_EMERG || !(__buf = _log_async_get()))) {
+    _log_async_drain();
+    return -1;
+  }
+  struct _log_async_record *const restrict __record =
+      _log_async_reserve(__buf, _LOG_ASYNC_RECORD_MAX);
+  if (unlikely(!__record))
+    return 0;
+
+  __record->lvl = lvl;
+  int __n = vsnprintf(__record->str, _LOG_LINE_MAX, fmt, ap);
+  if (unlikely(__n < 0))
+    __n = 0;
+  else if (unlikely(__n >= _LOG_LINE_MAX))
+    __n = _LOG_LINE_MAX - 1;
+  __record->str[__n] = '\0';
+
+  /* Shrink the reserved record to the formatted one before commit. */
+  struct spsc_record *const restrict __hdr = (struct spsc_record *)__record - 1;
+  __hdr->len = sizeof(*__record) + __n + 1;
+  __hdr->size = SPSC_RECORD_SIZE(__hdr->len);
+  _log_async_commit(__buf);
+  return 0;
+}
+
+static void *_log_async_main(void *arg) {
+  /* Polling interval (which bounds the latency of the missed wake-up) */
+  static const struct timespec __timeout = {.tv_nsec = 1000 * 1000};
+
+  while (__atomic_load_n(&_log_async_running, __ATOMIC_ACQUIRE)) {
+    _log_async_drain();
+
+    const uint32_t __event =
+        __atomic_load_n(&_log_async_event, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&_log_async_sleeping, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&_log_async_running, __ATOMIC_ACQUIRE))
+      syscall(SYS_futex, &_log_async_event, FUTEX_WAIT_PRIVATE, __event,
+              &__timeout, NULL, 0);
+    __atomic_store_n(&_log_async_sleeping, 0, __ATOMIC_RELAXED);
+  }
+  _log_async_drain();
+  return NULL;
+}
+
+int log_async_start(uint32_t size, int policy) {
+  if (!size)
+    size = LOG_ASYNC_SIZE;
+  if (size < LOG_ASYNC_SIZE_MIN || size > INT32_MAX ||
+      (policy != LOG_ASYNC_DROP && policy != LOG_ASYNC_BLOCK)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (_log_async) {
+    errno = EBUSY;
+    return -1;
+  }
+  log_verify_errno(pthread_once(&_log_async_key_once, _log_async_key_create));
+
+  _log_async_size = align_val_pow2(size, L1_CACHE_BYTES);
+  _log_async_policy = policy;
+  __atomic_store_n(&_log_async_running, 1, __ATOMIC_RELAXED);
+
+  /* Leave the signals to the other threads. */
+  sigset_t __oset;
+  log_verify_errno(pthread_sigmask(SIG_SETMASK, &_fset, &__oset));
+  const int __ret =
+      pthread_create(&_log_async_writer, NULL, _log_async_main, NULL);
+  log_verify_errno(pthread_sigmask(SIG_SETMASK, &__oset, NULL));
+  if (__ret) {
+    errno = __ret;
+    return -1;
+  }
+
+  __atomic_store_n(&_log_async, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+void log_async_stop() {
+  if (!_log_async)
+    return;
+  /* Log synchronously from now on. */
+  __atomic_store_n(&_log_async, 0, __ATOMIC_RELEASE);
+
+  __atomic_store_n(&_log_async_running, 0, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&_log_async_event, 1, __ATOMIC_RELEASE);
+  syscall(SYS_futex, &_log_async_event, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  log_verify_errno(pthread_join(_log_async_writer, NULL));
+}
+uint64_t log_async_dropped() {
+  return __atomic_load_n(&_log_async_nr_dropped, __ATOMIC_RELAXED);
+}
+
+/* Binary stream */
+
+static struct log_bin_desc *_log_bin_descs; // Registered ones
+static uint32_t _log_bin_nr_descs;
+
+static __always_inline int _log_bin_active() {
+  return __atomic_load_n(&_log_async, __ATOMIC_ACQUIRE) &&
+         __atomic_load_n(&_log_bin_fd, __ATOMIC_RELAXED) >= 0;
+}
+
+/* Check the conversions which cannot be deferred (or decoded in order). */
+static int _log_bin_deferrable(const char *restrict fmt) {
+  while ((fmt = strchr(fmt, '%'))) {
+    ++fmt;
+    if (*fmt == '%') {
+      ++fmt;
+      continue;
+    }
+    fmt += strspn(fmt, "-+ #0'I123456789.*hlLqjzt");
+    if (*fmt == '$' || *fmt == 'm' || !*fmt)
+      return 0;
+  }
+  return 1;
+}
+/*
+ * Store the precision of each conversion (_LOG_LINE_MAX if none) to `precs`
+ * by the argument, which bounds the copy of the string.
+ */
+static void _log_bin_precs(const char *restrict fmt, uint32_t *restrict precs,
+                           size_t nr_args) {
+  size_t __i = 0;
+  while ((fmt = strchr(fmt, '%')) && __i < nr_args) {
+    if (*++fmt == '%') {
+      ++fmt;
+      continue;
+    }
+    const char *const __spec = fmt;
+    fmt += strspn(fmt, "-+ #0'I123456789.*hlLqjzt");
+
+    uint32_t __prec = _LOG_LINE_MAX;
+    const char *const __dot = memchr(__spec, '.', fmt - __spec);
+    if (__dot && __dot[1] == '*')
+      __prec = _LOG_BIN_PREC_ARG |
+               (__i + !!memchr(__spec, '*', __dot - __spec)); // After width
+    else if (__dot) {
+      const unsigned long __n = strtoul(__dot + 1, NULL, 10);
+      if (__n < _LOG_LINE_MAX)
+        __prec = __n;
+    }
+    /* Skip the `*` argument(s). */
+    for (const char *__c = __spec; __c < fmt; ++__c)
+      __i += *__c == '*';
+    if (__i < nr_args)
+      precs[__i++] = __prec;
+  }
+}
+/* Return LOG_BIN_ARG_* of the parse_printf_format() type, or -1. */
+static int _log_bin_arg(int type) {
+  switch (type & ~PA_FLAG_MASK) {
+  case PA_INT:
+  case PA_CHAR:
+  case PA_WCHAR:
+    if (type & PA_FLAG_PTR)
+      return -1; // `%n`
+    return type & (PA_FLAG_LONG | PA_FLAG_LONG_LONG) ? LOG_BIN_ARG_LONG
+                                                      : LOG_BIN_ARG_INT;
+  case PA_STRING:
+    return LOG_BIN_ARG_STRING;
+  case PA_POINTER:
+    return LOG_BIN_ARG_POINTER;
+  case PA_FLOAT:
+  case PA_DOUBLE:
+    return type & PA_FLAG_LONG_DOUBLE ? LOG_BIN_ARG_LONG_DOUBLE
+                                      : LOG_BIN_ARG_DOUBLE;
+  }
+  return -1;
+}
+/* Store LOG_BIN_ARG_* of `fmt` to `args`; Return the number, or -1. */
+static int _log_bin_args(const char *restrict fmt, uint8_t *restrict args) {
+  int __types[LOG_BIN_ARGS_MAX];
+  const size_t __nr = parse_printf_format(fmt, LOG_BIN_ARGS_MAX, __types);
+  if (__nr > LOG_BIN_ARGS_MAX || !_log_bin_deferrable(fmt))
+    return -1;
+  for (size_t __i = 0; __i < __nr; ++__i) {
+    const int __arg = _log_bin_arg(__types[__i]);
+    if (__arg < 0)
+      return -1;
+    args[__i] = __arg;
+  }
+  return __nr;
+}
+
+static int _log_bin_write_desc(int fd, const struct log_bin_desc *desc,
+                               uint32_t id) {
+  struct log_bin_desc_record __record = {
+      .desc_id = id,
+      .lvl = desc->lvl,
+      .line = desc->line,
+      .nr_args = desc->nr_args,
+  };
+  struct iovec __iov[] = {
+      {&__record, sizeof(__record)},
+      {(void *)desc->args, desc->nr_args},
+      {(void *)desc->fmt, strlen(desc->fmt) + 1},
+      {(void *)desc->filename, strlen(desc->filename) + 1},
+      {(void *)desc->func, strlen(desc->func) + 1},
+  };
+  size_t __size = 0;
+  for (size_t __i = 0; __i < sizeof(__iov) / sizeof(*__iov); ++__i)
+    __size += __iov[__i].iov_len;
+  if (__size > _LOG_BIN_RECORD_MAX) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  __record.hdr = (struct log_bin_record){.size = __size,
+                                         .id = LOG_BIN_REC_DESC};
+  return _log_async_writev(fd, __iov, sizeof(__iov) / sizeof(*__iov));
+}
+
+static void _log_bin_register(struct log_bin_desc *restrict desc,
+                              const char *restrict file) {
+  /* This serializes the writes to the stream as well. */
+  log_verify_errno(pthread_mutex_lock(&_log_async_drain_lock));
+  if (__atomic_load_n(&desc->id, __ATOMIC_RELAXED) || _log_bin_fd < 0)
+    goto out;
+
+  const int __nr_args = _log_bin_args(desc->fmt, desc->args);
+  uint32_t __id = LOG_BIN_ID_TEXT;
+  if (__nr_args < 0 || _log_bin_nr_descs >= _LOG_BIN_DESCS_MAX)
+    goto publish;
+  _log_bin_precs(desc->fmt, desc->precs, __nr_args);
+  desc->nr_args = __nr_args;
+  desc->filename = file;
+
+  /* Publish the ID only after writing it (the entries refer to it). */
+  if (_log_bin_write_desc(_log_bin_fd, desc, _log_bin_nr_descs + 1))
+    goto publish; // Do not refer to it.
+  __id = ++_log_bin_nr_descs;
+  desc->next = _log_bin_descs;
+  _log_bin_descs = desc;
+
+publish:
+  __atomic_store_n(&desc->id, __id, __ATOMIC_RELEASE);
+out:
+  log_verify_errno(pthread_mutex_unlock(&_log_async_drain_lock));
+}
+
+/* Return 0 on success (including the drop), or -1 to log synchronously. */
+static int _log_bin_vwrite(const struct log_bin_desc *restrict desc,
+                           va_list ap) {
+  struct _log_async_buf *const restrict __buf = _log_async_get();
+  if (unlikely(!__buf))
+    return -1;
+
+  /* Size the entry first (with the length of the strings). */
+  uint32_t __lens[LOG_BIN_ARGS_MAX];
+  int __ints[LOG_BIN_ARGS_MAX]; // For `*` of the precision
+  uint32_t __size = sizeof(struct log_bin_entry);
+  va_list __aq;
+  va_copy(__aq, ap);
+  for (uint32_t __i = 0; __i < desc->nr_args; ++__i) {
+    switch (desc->args[__i]) {
+    case LOG_BIN_ARG_INT:
+      __ints[__i] = va_arg(__aq, int);
+      __size += sizeof(int32_t);
+      break;
+    case LOG_BIN_ARG_LONG:
+    case LOG_BIN_ARG_POINTER:
+      va_arg(__aq, uint64_t);
+      __size += sizeof(uint64_t);
+      break;
+    case LOG_BIN_ARG_DOUBLE:
+      va_arg(__aq, double);
+      __size += sizeof(double);
+      break;
+    case LOG_BIN_ARG_LONG_DOUBLE:
+      va_arg(__aq, long double);
+      __size += sizeof(long double);
+      break;
+    case LOG_BIN_ARG_STRING: {
+      const char *const restrict __s = va_arg(__aq, const char *);
+      /* Never read past the precision (longer than the line falls back). */
+      uint32_t __max = desc->precs[__i];
+      if (__max & _LOG_BIN_PREC_ARG)
+        __max = __ints[__max & ~_LOG_BIN_PREC_ARG];
+      if (__max > _LOG_LINE_MAX) // Also negative `*` (no precision)
+        __max = _LOG_LINE_MAX;
+      __lens[__i] = __s ? strnlen(__s, __max) : UINT32_MAX;
+      __size += sizeof(uint32_t) + (__s ? __lens[__i] : 0);
+      break;
+    }
+    }
+  }
+  va_end(__aq);
+  if (unlikely(__size > _LOG_LINE_MAX))
+    return -1;
+
+  struct _log_async_record *const restrict __record =
+      _log_async_reserve(__buf, sizeof(*__record) + __size);
+  if (unlikely(!__record))
+    return 0;
+  __record->lvl = _LOG_ASYNC_BIN;
+
+  struct log_bin_entry *const restrict __entry = (void *)__record->str;
+  *__entry = (struct log_bin_entry){
+      .hdr = {.size = __size, .id = desc->id},
+      .tid = _log_gettid(),
+      .tsc = __rdtsc(),
+  };
+  unsigned char *restrict __p = (unsigned char *)(__entry + 1);
+  for (uint32_t __i = 0; __i < desc->nr_args; ++__i) {
+    switch (desc->args[__i]) {
+    case LOG_BIN_ARG_INT: {
+      const int32_t __v = va_arg(ap, int);
+      __p = mempcpy(__p, &__v, sizeof(__v));
+      break;
+    }
+    case LOG_BIN_ARG_LONG:
+    case LOG_BIN_ARG_POINTER: {
+      const uint64_t __v = va_arg(ap, uint64_t);
+      __p = mempcpy(__p, &__v, sizeof(__v));
+      break;
+    }
+    case LOG_BIN_ARG_DOUBLE: {
+      const double __v = va_arg(ap, double);
+      __p = mempcpy(__p, &__v, sizeof(__v));
+      break;
+    }
+    case LOG_BIN_ARG_LONG_DOUBLE: {
+      const long double __v = va_arg(ap, long double);
+      __p = mempcpy(__p, &__v, sizeof(__v));
+      break;
+    }
+    case LOG_BIN_ARG_STRING: {
+      const char *const restrict __s = va_arg(ap, const char *);
+      __p = mempcpy(__p, __lens + __i, sizeof(*__lens));
+      if (__s)
+        __p = mempcpy(__p, __s, __lens[__i]);
+      break;
+    }
+    }
+  }
+  _log_async_commit(__buf);
+  return 0;
+}
+
+void _log_bin(struct log_bin_desc *restrict desc, const char *restrict file,
+              ...) {
+  va_list __ap;
+  va_start(__ap, file);
+  if (likely(_log_bin_active())) {
+    if (unlikely(!__atomic_load_n(&desc->id, __ATOMIC_ACQUIRE)))
+      _log_bin_register(desc, file);
+    if (likely(desc->id != LOG_BIN_ID_TEXT) && !_log_bin_vwrite(desc, __ap)) {
+      va_end(__ap);
+      return;
+    }
+  }
+  _vlog(desc->lvl, file, desc->line, desc->func, desc->fmt, __ap);
+  va_end(__ap);
+}
+
+int log_bin_open(int fd) {
+  if (fd < 0) {
+    errno = EBADF;
+    return -1;
+  }
+
+  if (sizeof(struct log_bin_stream) + strlen(_ident) + 1 >
+      _LOG_BIN_RECORD_MAX) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  struct log_bin_stream __stream = {
+      .hdr = {.size = sizeof(__stream) + strlen(_ident) + 1,
+              .id = LOG_BIN_REC_STREAM},
+      .magic = LOG_BIN_MAGIC,
+      .tsc_freq_hz = usersched_tsc_freq_hz,
+      .pid = getpid(),
+  };
+  __stream.tsc_base = _log_tsc_base(&__stream.realtime_base);
+  struct iovec __iov[] = {
+      {&__stream, sizeof(__stream)},
+      {(void *)_ident, strlen(_ident) + 1},
+  };
+
+  int __ret = -1;
+  log_verify_errno(pthread_mutex_lock(&_log_async_drain_lock));
+  if (_log_bin_fd >= 0) {
+    errno = EBUSY;
+    goto out;
+  }
+  if (_log_async_writev(fd, __iov, sizeof(__iov) / sizeof(*__iov)))
+    goto out;
+  for (const struct log_bin_desc *__desc = _log_bin_descs; __desc;
+       __desc = __desc->next)
+    if (_log_bin_write_desc(fd, __desc, __desc->id))
+      goto out;
+  __atomic_store_n(&_log_bin_fd, fd, __ATOMIC_RELAXED);
+  __ret = 0;
+out:;
+  const int __errno = errno;
+  log_verify_errno(pthread_mutex_unlock(&_log_async_drain_lock));
+  errno = __errno;
+  return __ret;
+}
+void log_bin_close() {
+  if (_log_bin_fd < 0)
+    return;
+  /* Write out the entries to the stream first. */
+  if (__atomic_load_n(&_log_async, __ATOMIC_ACQUIRE))
+    _log_async_drain();
+
+  log_verify_errno(pthread_mutex_lock(&_log_async_drain_lock));
+  __atomic_store_n(&_log_bin_fd, -1, __ATOMIC_RELAXED);
+  log_verify_errno(pthread_mutex_unlock(&_log_async_drain_lock));
+}
+
+/* Decoder */
+
+struct _log_bin_decoder {
+  FILE *in;
+  int out_fd;
+  char *ident;
+  struct _log_tsc_conv conv;
+  struct log_bin_desc **descs; // Indexed by the ID
+  uint32_t nr_descs;
+  struct {
+    int32_t tid;
+    uint64_t tsc;
+  } *prevs; // Previous TSC per thread (for LOG_TIMESTAMP_DELTA)
+  uint32_t nr_prevs;
+  unsigned char *buf;
+  uint32_t buf_size;
+};
+
+static void _log_bin_reset(struct _log_bin_decoder *restrict dec) {
+  for (uint32_t __i = 0; __i < dec->nr_descs; ++__i)
+    free(dec->descs[__i]);
+  free(dec->descs);
+  dec->descs = NULL;
+  dec->nr_descs = 0;
+  free(dec->ident);
+  dec->ident = NULL;
+  free(dec->prevs);
+  dec->prevs = NULL;
+  dec->nr_prevs = 0;
+}
+/* Return the previous TSC slot of `tid`, or NULL. */
+static uint64_t *_log_bin_prev(struct _log_bin_decoder *restrict dec,
+                               int32_t tid) {
+  for (uint32_t __i = 0; __i < dec->nr_prevs; ++__i)
+    if (dec->prevs[__i].tid == tid)
+      return &dec->prevs[__i].tsc;
+  typeof(dec->prevs) const restrict __prevs =
+      reallocarray(dec->prevs, dec->nr_prevs + 1, sizeof(*__prevs));
+  if (!__prevs)
+    return NULL;
+  dec->prevs = __prevs;
+  __prevs[dec->nr_prevs].tid = tid;
+  __prevs[dec->nr_prevs].tsc = 0;
+  return &__prevs[dec->nr_prevs++].tsc;
+}
+
+/* Return the next record, or NULL with `errno` set (0 on EOF). */
+static struct log_bin_record *
+_log_bin_read(struct _log_bin_decoder *restrict dec) {
+  struct log_bin_record __hdr;
+  errno = 0;
+  if (fread(&__hdr, sizeof(__hdr), 1, dec->in) != 1) {
+    if (ferror(dec->in) && !errno)
+      errno = EIO;
+    return NULL;
+  }
+  if (__hdr.size < sizeof(__hdr) || __hdr.size > _LOG_BIN_RECORD_MAX) {
+    errno = EBADMSG;
+    return NULL;
+  }
+  if (__hdr.size + 1 > dec->buf_size) {
+    unsigned char *const restrict __buf = realloc(dec->buf, __hdr.size + 1);
+    if (!__buf)
+      return NULL;
+    dec->buf = __buf;
+    dec->buf_size = __hdr.size + 1;
+  }
+  memcpy(dec->buf, &__hdr, sizeof(__hdr));
+  if (fread(dec->buf + sizeof(__hdr), __hdr.size - sizeof(__hdr), 1,
+            dec->in) != 1 &&
+      __hdr.size > sizeof(__hdr)) {
+    errno = ferror(dec->in) ? EIO : EBADMSG; // Truncated
+    return NULL;
+  }
+  dec->buf[__hdr.size] = '\0'; // Terminate the last string anyway.
+  return (struct log_bin_record *)dec->buf;
+}
+
+/* Return the descriptor with its strings copied together, or NULL. */
+static struct log_bin_desc *
+_log_bin_parse_desc(const struct log_bin_desc_record *restrict record) {
+  /* Check the size first not to read past the end. */
+  if (record->hdr.size < sizeof(*record) ||
+      record->nr_args > LOG_BIN_ARGS_MAX ||
+      record->hdr.size < sizeof(*record) + record->nr_args ||
+      !record->desc_id || record->desc_id > _LOG_BIN_DESCS_MAX ||
+      record->lvl < LOG_EMERG || record->lvl > LOG_DEBUG) {
+    errno = EBADMSG;
+    return NULL;
+  }
+  const char *const __strs = (const char *)(record + 1) + record->nr_args;
+  const char *const __end = (const char *)record + record->hdr.size;
+
+  struct log_bin_desc *const restrict __desc =
+      malloc(sizeof(*__desc) + (__end - __strs));
+  if (!__desc)
+    return NULL;
+  const char *__s = memcpy(__desc + 1, __strs, __end - __strs);
+  const char *const __s_end = __s + (__end - __strs);
+  const char **const __fields[] = {&__desc->fmt, &__desc->filename,
+                                   &__desc->func};
+  for (size_t __i = 0; __i < sizeof(__fields) / sizeof(*__fields); ++__i) {
+    const char *const __nul = memchr(__s, '\0', __s_end - __s);
+    if (!__nul) {
+      free(__desc);
+      errno = EBADMSG;
+      return NULL;
+    }
+    *__fields[__i] = __s;
+    __s = __nul + 1;
+  }
+  __desc->lvl = record->lvl;
+  __desc->line = record->line;
+  __desc->id = record->desc_id;
+  __desc->nr_args = record->nr_args;
+  memcpy(__desc->args, record + 1, record->nr_args);
+
+  /* The arguments should be of the format not to misformat them. */
+  uint8_t __args[LOG_BIN_ARGS_MAX];
+  if (_log_bin_args(__desc->fmt, __args) != (int)__desc->nr_args ||
+      memcmp(__args, __desc->args, __desc->nr_args)) {
+    free(__desc);
+    errno = EBADMSG;
+    return NULL;
+  }
+  return __desc;
+}
+static int _log_bin_add_desc(struct _log_bin_decoder *restrict dec,
+                             struct log_bin_desc *restrict desc) {
+  if (desc->id > dec->nr_descs) {
+    struct log_bin_desc **const restrict __descs =
+        reallocarray(dec->descs, desc->id, sizeof(*__descs));
+    if (!__descs)
+      return -1;
+    memset(__descs + dec->nr_descs, 0,
+           sizeof(*__descs) * (desc->id - dec->nr_descs));
+    dec->descs = __descs;
+    dec->nr_descs = desc->id;
+  }
+  free(dec->descs[desc->id - 1]);
+  dec->descs[desc->id - 1] = desc;
+  return 0;
+}
+
+union _log_bin_value {
+  int32_t i;
+  uint64_t l;
+  double d;
+  long double ld;
+  const char *s;
+};
+/* Format the decoded arguments like snprintf() (if `size` is non-zero). */
+static void _log_bin_format(char *restrict buf, size_t size,
+                            const struct log_bin_desc *restrict desc,
+                            const union _log_bin_value *restrict values) {
+  const char *restrict __fmt = desc->fmt;
+  size_t __len = 0;
+  uint32_t __i = 0;
+  while (*__fmt && __len < size - 1) {
+    const char *const __pct = strchrnul(__fmt, '%');
+    size_t __n = __pct - __fmt;
+    if (__n > size - 1 - __len)
+      __n = size - 1 - __len;
+    memcpy(buf + __len, __fmt, __n);
+    __len += __n;
+    if (!*__pct || __len == size - 1)
+      break;
+    if (__pct[1] == '%') {
+      buf[__len++] = '%';
+      __fmt = __pct + 2;
+      continue;
+    }
+
+    char __spec[32];
+    const size_t __spec_len =
+        strspn(__pct + 1, "-+ #0'I123456789.*hlLqjzt") + 2;
+    if (__spec_len >= sizeof(__spec))
+      break;
+    memcpy(__spec, __pct, __spec_len);
+    __spec[__spec_len] = '\0';
+    __fmt = __pct + __spec_len;
+
+    /* Clamp the width and the precision not to pad (or zero) for long. */
+    for (char *__c = __spec; *__c; ++__c) {
+      if (*__c < '1' || *__c > '9')
+        continue;
+      char *__e;
+      if (strtoul(__c, &__e, 10) > _LOG_BIN_WIDTH_MAX) {
+        char __max[16];
+        const int __n =
+            snprintf(__max, sizeof(__max), "%d", _LOG_BIN_WIDTH_MAX);
+        memmove(__c + __n, __e, strlen(__e) + 1);
+        memcpy(__c, __max, __n);
+        __e = __c + __n;
+      }
+      __c = __e - 1;
+    }
+    /* `*` takes the preceding int argument(s). */
+    int __stars[2], __nr_stars = 0;
+    for (const char *__c = __spec; *__c; ++__c)
+      if (*__c == '*' && __nr_stars < 2 && __i < desc->nr_args) {
+        const int __v = values[__i++].i;
+        __stars[__nr_stars++] = __v < -_LOG_BIN_WIDTH_MAX ? -_LOG_BIN_WIDTH_MAX
+                                : __v > _LOG_BIN_WIDTH_MAX ? _LOG_BIN_WIDTH_MAX
+                                                           : __v;
+      }
+    if (__i >= desc->nr_args)
+      break;
+
+    char *const __p = buf + __len;
+    const size_t __rem = size - __len;
+#define _log_bin_snprintf(value)                                               \
+  (__nr_stars == 2   ? snprintf(__p, __rem, __spec, __stars[0], __stars[1],    \
+                                value)                                         \
+   : __nr_stars == 1 ? snprintf(__p, __rem, __spec, __stars[0], value)         \
+                     : snprintf(__p, __rem, __spec, value))
+    const union _log_bin_value *const restrict __v = values + __i;
+    int __ret = 0;
+    switch (desc->args[__i++]) {
+    case LOG_BIN_ARG_INT:
+      __ret = _log_bin_snprintf(__v->i);
+      break;
+    case LOG_BIN_ARG_LONG:
+      __ret = _log_bin_snprintf(__v->l);
+      break;
+    case LOG_BIN_ARG_POINTER:
+      __ret = _log_bin_snprintf(address_cast(__v->l));
+      break;
+    case LOG_BIN_ARG_DOUBLE:
+      __ret = _log_bin_snprintf(__v->d);
+      break;
+    case LOG_BIN_ARG_LONG_DOUBLE:
+      __ret = _log_bin_snprintf(__v->ld);
+      break;
+    case LOG_BIN_ARG_STRING:
+      __ret = _log_bin_snprintf(__v->s);
+      break;
+    }
+#undef _log_bin_snprintf
+    if (__ret > 0)
+      __len += (size_t)__ret < __rem ? (size_t)__ret : __rem - 1;
+  }
+  buf[__len] = '\0';
+}
+
+static int _log_bin_decode_entry(struct _log_bin_decoder *restrict dec,
+                                 const struct log_bin_entry *restrict entry) {
+  const struct log_bin_desc *const restrict __desc =
+      entry->hdr.id <= dec->nr_descs ? dec->descs[entry->hdr.id - 1] : NULL;
+  if (!__desc || !dec->ident || entry->hdr.size < sizeof(*entry)) {
+    errno = EBADMSG;
+    return -1;
+  }
+
+  union _log_bin_value __values[LOG_BIN_ARGS_MAX];
+  char __strs[_LOG_LINE_MAX + LOG_BIN_ARGS_MAX], *restrict __s = __strs;
+  const unsigned char *restrict __p = (const unsigned char *)(entry + 1);
+  const unsigned char *const __end =
+      (const unsigned char *)entry + entry->hdr.size;
+  for (uint32_t __i = 0; __i < __desc->nr_args; ++__i) {
+    union _log_bin_value *const restrict __v = __values + __i;
+    size_t __size;
+    switch (__desc->args[__i]) {
+    case LOG_BIN_ARG_INT:
+      __size = sizeof(__v->i);
+      break;
+    case LOG_BIN_ARG_LONG:
+    case LOG_BIN_ARG_POINTER:
+      __size = sizeof(__v->l);
+      break;
+    case LOG_BIN_ARG_DOUBLE:
+      __size = sizeof(__v->d);
+      break;
+    case LOG_BIN_ARG_LONG_DOUBLE:
+      __size = sizeof(__v->ld);
+      break;
+    case LOG_BIN_ARG_STRING: {
+      uint32_t __len;
+      if (__end - __p < (ptrdiff_t)sizeof(__len))
+        goto err;
+      memcpy(&__len, __p, sizeof(__len));
+      __p += sizeof(__len);
+      if (__len == UINT32_MAX) {
+        __v->s = NULL;
+        continue;
+      }
+      if (__end - __p < __len || __strs + sizeof(__strs) - __s <= __len)
+        goto err;
+      __v->s = __s;
+      __s = mempcpy(__s, __p, __len);
+      *__s++ = '\0';
+      __p += __len;
+      continue;
+    }
+    default:
+      goto err;
+    }
+    if (__end - __p < (ptrdiff_t)__size)
+      goto err;
+    memcpy(__v, __p, __size);
+    __p += __size;
+  }
+
+  char __msg[_LOG_LINE_MAX], __ts[_LOG_TIMESTAMP_MAX] = "";
+  _log_bin_format(__msg, sizeof(__msg), __desc, __values);
+  if (_log_ts_mode != LOG_TIMESTAMP_NONE) {
+    uint64_t *const restrict __prev = _log_bin_prev(dec, entry->tid);
+    if (!__prev)
+      return -1;
+    _log_timestamp(__ts, &dec->conv, entry->tsc, __prev);
+  }
+  dprintf(dec->out_fd, _LOG_STDERR_FMT, __ts, dec->ident, entry->tid,
+          _LOG_LVL_TO_COLOR[__desc->lvl], _LOG_LVL_TO_STR[__desc->lvl],
+          __desc->filename, __desc->line, __desc->func, __msg);
+  return 0;
+
+err:
+  errno = EBADMSG;
+  return -1;
+}
+
+int log_bin_decode(int fd, int out_fd) {
+  struct _log_bin_decoder __dec = {.out_fd = out_fd};
+  const int __fd = dup(fd);
+  if (__fd < 0)
+    return -1;
+  if (!(__dec.in = fdopen(__fd, "r"))) {
+    close(__fd);
+    return -1;
+  }
+
+  int __ret = -1;
+  const struct log_bin_record *restrict __record;
+  while ((__record = _log_bin_read(&__dec))) {
+    switch (__record->id) {
+    case LOG_BIN_REC_STREAM: {
+      const struct log_bin_stream *const restrict __stream =
+          (const void *)__record;
+      if (__record->size < sizeof(*__stream) ||
+          memcmp(__stream->magic, LOG_BIN_MAGIC, sizeof(__stream->magic)) ||
+          !__stream->tsc_freq_hz) {
+        errno = EBADMSG;
+        goto out;
+      }
+      _log_bin_reset(&__dec);
+      _log_tsc_conv_init(&__dec.conv, __stream->tsc_freq_hz,
+                         __stream->tsc_base, __stream->realtime_base);
+      if (!(__dec.ident = strdup((const char *)(__stream + 1))))
+        goto out;
+      break;
+    }
+    case LOG_BIN_REC_DESC: {
+      struct log_bin_desc *const restrict __desc =
+          _log_bin_parse_desc((const void *)__record);
+      if (!__desc)
+        goto out;
+      if (_log_bin_add_desc(&__dec, __desc)) {
+        free(__desc);
+        goto out;
+      }
+      break;
+    }
+    default:
+      if (_log_bin_decode_entry(&__dec, (const void *)__record))
+        goto out;
+    }
+  }
+  if (!errno)
+    __ret = 0;
+
+out:;
+  const int __errno = errno;
+  _log_bin_reset(&__dec);
+  free(__dec.buf);
+  fclose(__dec.in);
+  errno = __errno;
+  return __ret;
+}
+
+/* Backtrace */
+
+static struct backtrace_state *_log_bt_state; // Created once and reused
+static pthread_once_t _log_bt_once = PTHREAD_ONCE_INIT;
+static void _log_bt_error(void *data, const char *msg, int errnum) {}
+static void _log_bt_init() {
+  _log_bt_state = backtrace_create_state(NULL, 1, _log_bt_error, NULL);
+}
+
+/* PC-to-symbol cache (direct-mapped, under `_log_bt_lock`) */
+enum { _LOG_BT_CACHE_BITS = 10, _LOG_BT_INLINE_MAX = 4 };
+struct _log_bt_sym {
+  uintptr_t pc; // 0 if empty
+  /* dladdr() */
+  const char *module;
+  uintptr_t base, offset; // `offset` is 0 if exact or unknown.
+  int known;              // Whether the symbol is found
+  /* backtrace_pcinfo() (from the innermost inlined one) */
+  uint32_t nr_frames; // 0 if not symbolized yet
+  struct {
+    const char *filepath, *func;
+    int line;
+  } frames[_LOG_BT_INLINE_MAX];
+};
+static struct _log_bt_sym _log_bt_cache[1 << _LOG_BT_CACHE_BITS];
+static pthread_mutex_t _log_bt_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int _log_bt_pcinfo(void *data, uintptr_t pc, const char *filepath,
+                          int line, const char *func) {
+  struct _log_bt_sym *const restrict __sym = data;
+  if (__sym->nr_frames < _LOG_BT_INLINE_MAX)
+    __sym->frames[__sym->nr_frames++] =
+        (typeof(*__sym->frames)){filepath, func, line};
+  return 0;
+}
+/* Return the cached symbol of `pc` (resolved with DWARF if `symbolize`). */
+static const struct _log_bt_sym *_log_bt_resolve(uintptr_t pc,
+                                                 int symbolize) {
+  struct _log_bt_sym *const restrict __sym =
+      _log_bt_cache +
+      ((pc * 0x9e3779b97f4a7c15ULL) >> (64 - _LOG_BT_CACHE_BITS));
+  if (__sym->pc != pc) {
+    Dl_info __info;
+    if (!dladdr(address_cast(pc), &__info))
+      __info = (Dl_info){0};
+    *__sym = (struct _log_bt_sym){
+        .pc = pc,
+        .module = __info.dli_fname,
+        .base = value_cast(__info.dli_fbase),
+        .offset = __info.dli_saddr ? pc - value_cast(__info.dli_saddr) : 0,
+        .known = !!__info.dli_saddr,
+    };
+  }
+  if (symbolize && !__sym->nr_frames) {
+    pthread_once(&_log_bt_once, _log_bt_init);
+    if (_log_bt_state)
+      backtrace_pcinfo(_log_bt_state, pc, _log_bt_pcinfo, _log_bt_error,
+                       __sym);
+    if (!__sym->nr_frames)
+      __sym->nr_frames = 1; // Unknown (all NULL)
+  }
+  return __sym;
+}
+
+static void _log_bt_print_frame(int lvl, const struct _log_bt_sym *sym,
+                                uint32_t i) {
+  const uintptr_t __pc = sym->pc;
+  const char *const restrict __func = sym->frames[i].func;
+  const char *const restrict __file = filename(sym->frames[i].filepath);
+  const int __line = sym->frames[i].line;
 
-  const int __lvl = value_cast(data, int);
   if (_use_syslog) {
-    if (__offset)
-      syslog(__lvl, _LOG_BACKTRACE_SYSLOG_FMT_OFFSET, _LOG_LVL_TO_COLOR[__lvl],
-             func, __offset, filename(filepath), line, pc);
+    if (sym->offset)
+      syslog(lvl, _LOG_BACKTRACE_SYSLOG_FMT_OFFSET, _LOG_LVL_TO_COLOR[lvl],
+             __func, sym->offset, __file, __line, __pc);
     else
-      syslog(__lvl,
-             __saddr ? _LOG_BACKTRACE_SYSLOG_FMT
-                     : _LOG_BACKTRACE_SYSLOG_FMT_UNKNOWN,
-             _LOG_LVL_TO_COLOR[__lvl], func, filename(filepath), line, pc);
+      syslog(lvl,
+             sym->known ? _LOG_BACKTRACE_SYSLOG_FMT
+                        : _LOG_BACKTRACE_SYSLOG_FMT_UNKNOWN,
+             _LOG_LVL_TO_COLOR[lvl], __func, __file, __line, __pc);
   } else {
-    if (__offset)
+    if (sym->offset)
       dprintf(STDERR_FILENO, _LOG_BACKTRACE_STDERR_FMT_OFFSET,
-              _LOG_LVL_TO_COLOR[__lvl], func, __offset, filename(filepath),
-              line, pc);
+              _LOG_LVL_TO_COLOR[lvl], __func, sym->offset, __file, __line,
+              __pc);
     else
       dprintf(STDERR_FILENO,
-              __saddr ? _LOG_BACKTRACE_STDERR_FMT
-                      : _LOG_BACKTRACE_STDERR_FMT_UNKNOWN,
-              _LOG_LVL_TO_COLOR[__lvl], func, filename(filepath), line, pc);
+              sym->known ? _LOG_BACKTRACE_STDERR_FMT
+                         : _LOG_BACKTRACE_STDERR_FMT_UNKNOWN,
+              _LOG_LVL_TO_COLOR[lvl], __func, __file, __line, __pc);
   }
+}
+static void _log_bt_print(int lvl, const char *restrict file, int line,
+                          const char *restrict func,
+                          const struct log_backtrace *restrict bt, int raw) {
+  /* Keep the order with the pending records. */
+  if (__atomic_load_n(&_log_async, __ATOMIC_ACQUIRE))
+    _log_async_drain();
 
-  return 0;
+  char __ts[_LOG_TIMESTAMP_MAX];
+  _log_timestamp_now(__ts);
+  if (_use_syslog)
+    syslog(lvl, _LOG_SYSLOG_FMT, __ts, _LOG_LVL_TO_COLOR[lvl],
+           _LOG_LVL_TO_STR[lvl], file, line, func, _LOG_BACKTRACE_MSG);
+  else
+    dprintf(STDERR_FILENO, _LOG_STDERR_FMT, __ts, _ident, _log_gettid(),
+            _LOG_LVL_TO_COLOR[lvl], _LOG_LVL_TO_STR[lvl], file, line, func,
+            _LOG_BACKTRACE_MSG);
+
+  /* This also keeps the frames of a backtrace together. */
+  log_verify_errno(pthread_mutex_lock(&_log_bt_lock));
+  for (uint32_t __i = 0; __i < bt->nr; ++__i) {
+    const struct _log_bt_sym *const restrict __sym =
+        _log_bt_resolve(bt->pc[__i], !raw);
+    if (raw) {
+      const char *const restrict __module =
+          __sym->module ? __sym->module : "?";
+      if (_use_syslog)
+        syslog(lvl, _LOG_BACKTRACE_SYSLOG_FMT_RAW, _LOG_LVL_TO_COLOR[lvl],
+               __module, __sym->pc - __sym->base, __sym->pc);
+      else
+        dprintf(STDERR_FILENO, _LOG_BACKTRACE_STDERR_FMT_RAW,
+                _LOG_LVL_TO_COLOR[lvl], __module, __sym->pc - __sym->base,
+                __sym->pc);
+      continue;
+    }
+    for (uint32_t __j = 0; __j < __sym->nr_frames; ++__j)
+      _log_bt_print_frame(lvl, __sym, __j);
+  }
+  log_verify_errno(pthread_mutex_unlock(&_log_bt_lock));
+}
+
+static int _log_bt_capture(void *data, uintptr_t pc) {
+  struct log_backtrace *const restrict __bt = data;
+  if (unlikely(pc == UINTPTR_MAX))
+    return 1; // The end of the stack
+  __bt->pc[__bt->nr++] = pc;
+  return __bt->nr == LOG_BACKTRACE_DEPTH;
+}
+__attribute((noinline)) uint32_t
+log_backtrace_capture(struct log_backtrace *restrict bt, int skip) {
+  bt->nr = 0;
+  pthread_once(&_log_bt_once, _log_bt_init);
+  if (likely(_log_bt_state))
+    backtrace_simple(_log_bt_state, skip + 1, _log_bt_capture, _log_bt_error,
+                     bt);
+  return bt->nr;
 }
+
 void _log_backtrace(int lvl, const char *restrict filename, int line,
                     const char *restrict func, int skip_lock) {
   if (!skip_lock)
     _log_lock();
 
-  if (_use_syslog)
-    syslog(lvl, _LOG_SYSLOG_FMT, _LOG_LVL_TO_COLOR[lvl], _LOG_LVL_TO_STR[lvl],
-           filename, line, func, _LOG_BACKTRACE_MSG);
-  else
-    dprintf(STDERR_FILENO, _LOG_STDERR_FMT, _ident, gettid(),
-            _LOG_LVL_TO_COLOR[lvl], _LOG_LVL_TO_STR[lvl], filename, line, func,
-            _LOG_BACKTRACE_MSG);
+  struct log_backtrace __bt;
+  log_backtrace_capture(&__bt, 0); // From here
+  _log_bt_print(lvl, filename, line, func, &__bt, 0);
+
+  if (!skip_lock)
+    _log_unlock();
+}
+void _log_backtrace_print(int lvl, const char *restrict filename, int line,
+                          const char *restrict func,
+                          const struct log_backtrace *restrict bt, int raw,
+                          int skip_lock) {
+  if (!skip_lock)
+    _log_lock();
 
-  struct backtrace_state *const restrict __state =
-      backtrace_create_state(NULL, 0, NULL, NULL);
-  backtrace_full(__state, 0, _backtrace_callback, NULL, address_cast(lvl));
+  _log_bt_print(lvl, filename, line, func, bt, raw);
 
   if (!skip_lock)
     _log_unlock();
@@ -199,21 +1453,28 @@ _log(int lvl, const char *restrict filename, int line,
   va_end(__ap);
 }
 
-enum { _LOG_LINE_MAX = LOG_LINE_MAX * 2 };
 void _vlog(int lvl, const char *restrict filename, int line,
            const char *restrict func, const char *restrict fmt, va_list ap) {
-  char __buf[_LOG_LINE_MAX];
+  char __buf[_LOG_LINE_MAX], __ts[_LOG_TIMESTAMP_MAX];
+  _log_timestamp_now(__ts);
 
   if (_use_syslog) {
-    snprintf(__buf, _LOG_LINE_MAX, _LOG_SYSLOG_FMT, _LOG_LVL_TO_COLOR[lvl],
-             _LOG_LVL_TO_STR[lvl], filename, line, func, fmt);
+    snprintf(__buf, _LOG_LINE_MAX, _LOG_SYSLOG_FMT, __ts,
+             _LOG_LVL_TO_COLOR[lvl], _LOG_LVL_TO_STR[lvl], filename, line, func,
+             fmt);
 
+    if (__atomic_load_n(&_log_async, __ATOMIC_ACQUIRE) &&
+        !_log_async_vlog(lvl, __buf, ap))
+      return;
     vsyslog(lvl, __buf, ap);
   } else {
-    snprintf(__buf, _LOG_LINE_MAX, _LOG_STDERR_FMT, _ident, gettid(),
+    snprintf(__buf, _LOG_LINE_MAX, _LOG_STDERR_FMT, __ts, _ident, _log_gettid(),
              _LOG_LVL_TO_COLOR[lvl], _LOG_LVL_TO_STR[lvl], filename, line, func,
              fmt);
 
+    if (__atomic_load_n(&_log_async, __ATOMIC_ACQUIRE) &&
+        !_log_async_vlog(lvl, __buf, ap))
+      return;
     vdprintf(STDERR_FILENO, __buf, ap);
   }
 }
@@ -0,0 +1,296 @@
+#include "x86linux/helper.h"
+
+/* Compare 8 bytes per iteration against the broadcast word. */
+static size_t _memvspn(const unsigned char *restrict s, unsigned char c,
+                       size_t off, size_t n) {
+  const uint64_t __v = 0x0101010101010101ull * c;
+  for (; likely(off + 8 <= n); off += 8) {
+    uint64_t __w;
+    __builtin_memcpy(&__w, s + off, sizeof(__w));
+    if (__w != __v)
+      return off + (__builtin_ctzll(__w ^ __v) >> 3);
+  }
+  for (; off < n && *(s + off) == c; ++off)
+    ;
+  return off;
+}
+
+#ifndef __KERNEL__
+
+/* Test 128 bytes per iteration, then find the exact byte in 32 bytes. */
+static __attribute((target("avx2"))) size_t
+_memvspn_avx2(const unsigned char *restrict s, unsigned char c, size_t n) {
+  const __m256i __c = _mm256_set1_epi8(c);
+
+  size_t __off = 0;
+  for (; likely(__off + 128 <= n); __off += 128) {
+    const __m256i __e0 = _mm256_cmpeq_epi8(
+        _mm256_loadu_si256((const __m256i *)(s + __off)), __c);
+    const __m256i __e1 = _mm256_cmpeq_epi8(
+        _mm256_loadu_si256((const __m256i *)(s + __off + 32)), __c);
+    const __m256i __e2 = _mm256_cmpeq_epi8(
+        _mm256_loadu_si256((const __m256i *)(s + __off + 64)), __c);
+    const __m256i __e3 = _mm256_cmpeq_epi8(
+        _mm256_loadu_si256((const __m256i *)(s + __off + 96)), __c);
+    const __m256i __e = _mm256_and_si256(_mm256_and_si256(__e0, __e1),
+                                         _mm256_and_si256(__e2, __e3));
+    if (_mm256_movemask_epi8(__e) != -1)
+      break;
+  }
+  for (; __off + 32 <= n; __off += 32) {
+    const uint32_t __m = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+        _mm256_loadu_si256((const __m256i *)(s + __off)), __c));
+    if (__m)
+      return __off + __builtin_ctz(__m);
+  }
+  return _memvspn(s, c, __off, n);
+}
+
+/* Test 256 bytes per iteration; The tail is handled by the masked load. */
+static __attribute((target("avx512f,avx512bw"))) size_t
+_memvspn_avx512(const unsigned char *restrict s, unsigned char c, size_t n) {
+  const __m512i __c = _mm512_set1_epi8(c);
+
+  size_t __off = 0;
+  for (; likely(__off + 256 <= n); __off += 256) {
+    const __m512i __x0 = _mm512_xor_si512(_mm512_loadu_si512(s + __off), __c);
+    const __m512i __x1 =
+        _mm512_xor_si512(_mm512_loadu_si512(s + __off + 64), __c);
+    const __m512i __x2 =
+        _mm512_xor_si512(_mm512_loadu_si512(s + __off + 128), __c);
+    const __m512i __x3 =
+        _mm512_xor_si512(_mm512_loadu_si512(s + __off + 192), __c);
+    const __m512i __x = _mm512_or_si512(_mm512_or_si512(__x0, __x1),
+                                        _mm512_or_si512(__x2, __x3));
+    if (_mm512_test_epi64_mask(__x, __x))
+      break;
+  }
+  for (; __off + 64 <= n; __off += 64) {
+    const __mmask64 __m =
+        _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(s + __off), __c);
+    if (__m)
+      return __off + __builtin_ctzll(__m);
+  }
+  if (__off < n) {
+    const __mmask64 __k = (1ull << (n - __off)) - 1;
+    const __mmask64 __m = _mm512_mask_cmpneq_epi8_mask(
+        __k, _mm512_maskz_loadu_epi8(__k, s + __off), __c);
+    if (__m)
+      return __off + __builtin_ctzll(__m);
+  }
+  return n;
+}
+
+#endif
+
+size_t memvspn(const void *restrict s, unsigned char c, size_t n) {
+#ifndef __KERNEL__
+  if (x86_support_avx512)
+    return _memvspn_avx512((const unsigned char *)s, c, n);
+  if (x86_support_avx2)
+    return _memvspn_avx2((const unsigned char *)s, c, n);
+#endif
+  return _memvspn((const unsigned char *)s, c, 0, n);
+}
+
+uint64_t memvcmp_pages(const void *restrict s, unsigned char c,
+                       size_t page_size, uint64_t nr_pages,
+                       bitset_t *restrict bitset) {
+  const unsigned char *restrict __s = (const unsigned char *)s;
+  uint64_t __cnt = 0;
+
+  /* Build each word locally to store it once. */
+  for (uint64_t __idx = 0; __idx < nr_pages; __idx += BITS_PER_BITSET) {
+    const uint64_t __nr =
+        nr_pages - __idx < BITS_PER_BITSET ? nr_pages - __idx : BITS_PER_BITSET;
+    bitset_t __word = 0;
+    for (uint64_t __i = 0; __i < __nr; ++__i, __s += page_size)
+      __word |= (bitset_t)(memvspn(__s, c, page_size) != page_size) << __i;
+    __cnt += __builtin_popcountll(__word);
+
+    bitset_t *const restrict __dest = bitset + __idx / BITS_PER_BITSET;
+    if (likely(__nr == BITS_PER_BITSET))
+      *__dest = __word;
+    else {
+      /* Keep the bits beyond `nr_pages`. */
+      const bitset_t __mask = (1ull << __nr) - 1;
+      *__dest = (*__dest & ~__mask) | __word;
+    }
+  }
+  return __cnt;
+}
+
+/* Move with (overlapping) 8-byte words inline. */
+static __always_inline void _memcpy_small(unsigned char *restrict d,
+                                          const unsigned char *restrict s,
+                                          size_t n) {
+  if (n >= 8) {
+    uint64_t __w;
+    for (size_t __off = 0; __off + 8 < n; __off += 8) {
+      __builtin_memcpy(&__w, s + __off, sizeof(__w));
+      __builtin_memcpy(d + __off, &__w, sizeof(__w));
+    }
+    __builtin_memcpy(&__w, s + n - 8, sizeof(__w));
+    __builtin_memcpy(d + n - 8, &__w, sizeof(__w));
+  } else if (n >= 4) {
+    uint32_t __w;
+    __builtin_memcpy(&__w, s, sizeof(__w));
+    __builtin_memcpy(d, &__w, sizeof(__w));
+    __builtin_memcpy(&__w, s + n - 4, sizeof(__w));
+    __builtin_memcpy(d + n - 4, &__w, sizeof(__w));
+  } else {
+    for (size_t __i = 0; __i < n; ++__i)
+      *(d + __i) = *(s + __i);
+  }
+}
+
+#ifndef __KERNEL__
+
+/* Move 128 bytes per iteration; The tail is moved by the last 32 bytes. */
+static __attribute((target("avx2"))) void
+_memcpy_avx2(unsigned char *restrict d, const unsigned char *restrict s,
+             size_t n) {
+  size_t __off = 0;
+  for (; __off + 128 <= n; __off += 128) {
+    const __m256i __x0 = _mm256_loadu_si256((const __m256i *)(s + __off));
+    const __m256i __x1 = _mm256_loadu_si256((const __m256i *)(s + __off + 32));
+    const __m256i __x2 = _mm256_loadu_si256((const __m256i *)(s + __off + 64));
+    const __m256i __x3 = _mm256_loadu_si256((const __m256i *)(s + __off + 96));
+    _mm256_storeu_si256((__m256i *)(d + __off), __x0);
+    _mm256_storeu_si256((__m256i *)(d + __off + 32), __x1);
+    _mm256_storeu_si256((__m256i *)(d + __off + 64), __x2);
+    _mm256_storeu_si256((__m256i *)(d + __off + 96), __x3);
+  }
+  for (; __off + 32 <= n; __off += 32)
+    _mm256_storeu_si256((__m256i *)(d + __off),
+                        _mm256_loadu_si256((const __m256i *)(s + __off)));
+  if (__off < n)
+    _mm256_storeu_si256((__m256i *)(d + n - 32),
+                        _mm256_loadu_si256((const __m256i *)(s + n - 32)));
+}
+/* Move 256 bytes per iteration; The tail is moved by the masked one. */
+static __attribute((target("avx512f,avx512bw"))) void
+_memcpy_avx512(unsigned char *restrict d, const unsigned char *restrict s,
+               size_t n) {
+  size_t __off = 0;
+  for (; __off + 256 <= n; __off += 256) {
+    const __m512i __x0 = _mm512_loadu_si512(s + __off);
+    const __m512i __x1 = _mm512_loadu_si512(s + __off + 64);
+    const __m512i __x2 = _mm512_loadu_si512(s + __off + 128);
+    const __m512i __x3 = _mm512_loadu_si512(s + __off + 192);
+    _mm512_storeu_si512(d + __off, __x0);
+    _mm512_storeu_si512(d + __off + 64, __x1);
+    _mm512_storeu_si512(d + __off + 128, __x2);
+    _mm512_storeu_si512(d + __off + 192, __x3);
+  }
+  for (; __off + 64 <= n; __off += 64)
+    _mm512_storeu_si512(d + __off, _mm512_loadu_si512(s + __off));
+  if (__off < n) {
+    const __mmask64 __k = (1ull << (n - __off)) - 1;
+    _mm512_mask_storeu_epi8(d + __off, __k,
+                            _mm512_maskz_loadu_epi8(__k, s + __off));
+  }
+}
+
+/*
+ * Stream to the aligned destination (the head and tail are moved normally),
+ * then SFENCE to order them before the following (release) stores.
+ */
+static void _memcpy_nt_sse2(unsigned char *restrict d,
+                            const unsigned char *restrict s, size_t n) {
+  const size_t __head = -(uintptr_t)d & 15;
+  _memcpy_small(d, s, __head);
+  size_t __off = __head;
+  for (; __off + 64 <= n; __off += 64) {
+    const __m128i __x0 = _mm_loadu_si128((const __m128i *)(s + __off));
+    const __m128i __x1 = _mm_loadu_si128((const __m128i *)(s + __off + 16));
+    const __m128i __x2 = _mm_loadu_si128((const __m128i *)(s + __off + 32));
+    const __m128i __x3 = _mm_loadu_si128((const __m128i *)(s + __off + 48));
+    _mm_stream_si128((__m128i *)(d + __off), __x0);
+    _mm_stream_si128((__m128i *)(d + __off + 16), __x1);
+    _mm_stream_si128((__m128i *)(d + __off + 32), __x2);
+    _mm_stream_si128((__m128i *)(d + __off + 48), __x3);
+  }
+  _memcpy_small(d + __off, s + __off, n - __off);
+  _mm_sfence();
+}
+static __attribute((target("avx2"))) void
+_memcpy_nt_avx2(unsigned char *restrict d, const unsigned char *restrict s,
+                size_t n) {
+  const size_t __head = -(uintptr_t)d & 31;
+  _memcpy_small(d, s, __head);
+  size_t __off = __head;
+  for (; __off + 128 <= n; __off += 128) {
+    const __m256i __x0 = _mm256_loadu_si256((const __m256i *)(s + __off));
+    const __m256i __x1 = _mm256_loadu_si256((const __m256i *)(s + __off + 32));
+    const __m256i __x2 = _mm256_loadu_si256((const __m256i *)(s + __off + 64));
+    const __m256i __x3 = _mm256_loadu_si256((const __m256i *)(s + __off + 96));
+    _mm256_stream_si256((__m256i *)(d + __off), __x0);
+    _mm256_stream_si256((__m256i *)(d + __off + 32), __x1);
+    _mm256_stream_si256((__m256i *)(d + __off + 64), __x2);
+    _mm256_stream_si256((__m256i *)(d + __off + 96), __x3);
+  }
+  for (; __off + 32 <= n; __off += 32)
+    _mm256_stream_si256((__m256i *)(d + __off),
+                        _mm256_loadu_si256((const __m256i *)(s + __off)));
+  _memcpy_small(d + __off, s + __off, n - __off);
+  _mm_sfence();
+}
+static __attribute((target("avx512f,avx512bw"))) void
+_memcpy_nt_avx512(unsigned char *restrict d, const unsigned char *restrict s,
+                  size_t n) {
+  const size_t __head = -(uintptr_t)d & 63;
+  _memcpy_small(d, s, __head);
+  size_t __off = __head;
+  for (; __off + 256 <= n; __off += 256) {
+    const __m512i __x0 = _mm512_loadu_si512(s + __off);
+    const __m512i __x1 = _mm512_loadu_si512(s + __off + 64);
+    const __m512i __x2 = _mm512_loadu_si512(s + __off + 128);
+    const __m512i __x3 = _mm512_loadu_si512(s + __off + 192);
+    _mm512_stream_si512((__m512i *)(d + __off), __x0);
+    _mm512_stream_si512((__m512i *)(d + __off + 64), __x1);
+    _mm512_stream_si512((__m512i *)(d + __off + 128), __x2);
+    _mm512_stream_si512((__m512i *)(d + __off + 192), __x3);
+  }
+  for (; __off + 64 <= n; __off += 64)
+    _mm512_stream_si512((__m512i *)(d + __off), _mm512_loadu_si512(s + __off));
+  if (__off < n) {
+    const __mmask64 __k = (1ull << (n - __off)) - 1;
+    _mm512_mask_storeu_epi8(d + __off, __k,
+                            _mm512_maskz_loadu_epi8(__k, s + __off));
+  }
+  _mm_sfence();
+}
+
+#endif
+
+void *memcpy_tiered(void *restrict dest, const void *restrict src, size_t n,
+                    size_t vec_min, size_t nt_min) {
+  unsigned char *const restrict __d = (unsigned char *)dest;
+  const unsigned char *const restrict __s = (const unsigned char *)src;
+
+  if (n < vec_min && n < nt_min) {
+    _memcpy_small(__d, __s, n);
+    return dest;
+  }
+#ifndef __KERNEL__
+  if (n >= nt_min && n >= 64) {
+    if (x86_support_avx512)
+      _memcpy_nt_avx512(__d, __s, n);
+    else if (x86_support_avx2)
+      _memcpy_nt_avx2(__d, __s, n);
+    else
+      _memcpy_nt_sse2(__d, __s, n);
+    return dest;
+  }
+  if (x86_support_avx512) {
+    _memcpy_avx512(__d, __s, n);
+    return dest;
+  }
+  if (x86_support_avx2 && n >= 32) {
+    _memcpy_avx2(__d, __s, n);
+    return dest;
+  }
+#endif
+  return __builtin_memcpy(dest, src, n);
+}
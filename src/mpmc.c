@@ -0,0 +1,274 @@
+#include "x86linux/helper.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <syscall.h>
+#include <unistd.h>
+
+static __always_inline struct mpmc_slot *
+_mpmc_slot(const struct mpmc_queue *restrict queue, uint64_t pos) {
+  return (struct mpmc_slot *)((unsigned char *)queue + queue->offset +
+                              (size_t)queue->slot_size * (pos & queue->mask));
+}
+/* The futex word is the lower half of the sequence (in little endian). */
+static __always_inline uint32_t *_mpmc_slot_seq32(struct mpmc_slot *slot) {
+  return (uint32_t *)&slot->seq;
+}
+
+size_t mpmc_queue_size(uint32_t nr_slots, uint32_t elem_size) {
+  return sizeof(struct mpmc_queue) +
+         (size_t)MPMC_SLOT_SIZE(elem_size) * nr_slots;
+}
+int mpmc_queue_init(struct mpmc_queue *restrict queue, uint32_t nr_slots,
+                    uint32_t elem_size) {
+  if (unlikely(!has_single_bit(nr_slots))) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  queue->pos_enq = queue->pos_deq = 0;
+  queue->mask = nr_slots - 1;
+  queue->elem_size = elem_size;
+  queue->slot_size = MPMC_SLOT_SIZE(elem_size);
+  queue->offset = sizeof(*queue);
+  queue->enq_event = queue->enq_waiters = 0;
+  queue->deq_event = queue->deq_waiters = 0;
+
+  /* The slot of `pos` is free for the producer when its sequence is `pos`. */
+  for (uint32_t __i = 0; __i < nr_slots; ++__i)
+    _mpmc_slot(queue, __i)->seq = __i;
+  return 0;
+}
+
+/* Wake up to `nr` waiters sleeping on `event` (if any). */
+static void _mpmc_wake(uint32_t *restrict event, uint32_t *restrict waiters,
+                       uint32_t nr, int flags) {
+  /* The sequence was stored with full memory barrier. */
+  if (likely(!__atomic_load_n(waiters, __ATOMIC_RELAXED)))
+    return;
+  __atomic_add_fetch(event, 1, __ATOMIC_RELEASE);
+  syscall(SYS_futex, event,
+          flags & FUTEX_PRIVATE_FLAG ? FUTEX_WAKE_PRIVATE : FUTEX_WAKE, nr,
+          NULL, NULL, 0);
+}
+
+/*
+ * Claim up to `nr` consecutive slots whose sequence is `pos` + `ready`.
+ *
+ * Return the number of claimed slots from `*pos`, or 0 with the sequence of the
+ * first slot (to wait on) stored to `*seq32` and `*seq32_save`.
+ */
+static uint32_t _mpmc_claim(struct mpmc_queue *restrict queue,
+                            uint64_t *restrict cursor, uint64_t ready,
+                            uint32_t nr, uint64_t *restrict pos,
+                            uint32_t **restrict seq32,
+                            uint32_t *restrict seq32_save) {
+  uint64_t __pos = __atomic_load_n(cursor, __ATOMIC_RELAXED);
+  for (;;) {
+    struct mpmc_slot *const restrict __slot = _mpmc_slot(queue, __pos);
+    const uint64_t __seq = __atomic_load_n(&__slot->seq, __ATOMIC_ACQUIRE);
+    const int64_t __diff = (int64_t)(__seq - (__pos + ready));
+    if (__diff < 0) {
+      /* Full (or empty) */
+      *seq32 = _mpmc_slot_seq32(__slot);
+      *seq32_save = (uint32_t)__seq;
+      return 0;
+    }
+    if (__diff > 0) {
+      /* Another thread has claimed it; Retry with the latest one. */
+      __pos = __atomic_load_n(cursor, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    /* Count the following ready slots (which cannot be taken but by us). */
+    uint32_t __nr = 1;
+    while (__nr < nr && __atomic_load_n(&_mpmc_slot(queue, __pos + __nr)->seq,
+                                        __ATOMIC_ACQUIRE) ==
+                            __pos + __nr + ready)
+      ++__nr;
+    if (__atomic_compare_exchange_n(cursor, &__pos, __pos + __nr, 1,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      *pos = __pos;
+      return __nr;
+    }
+  }
+}
+
+static uint32_t _mpmc_enqueue(struct mpmc_queue *restrict queue,
+                              const void *restrict elems, uint32_t nr,
+                              int flags, uint32_t **restrict seq32,
+                              uint32_t *restrict seq32_save) {
+  uint64_t __pos;
+  const uint32_t __nr =
+      _mpmc_claim(queue, &queue->pos_enq, 0, nr, &__pos, seq32, seq32_save);
+  for (uint32_t __i = 0; __i < __nr; ++__i) {
+    struct mpmc_slot *const restrict __slot = _mpmc_slot(queue, __pos + __i);
+    memcpy(__slot->elem,
+           (const unsigned char *)elems + (size_t)queue->elem_size * __i,
+           queue->elem_size);
+    /* Publish it with full memory barrier to check the waiters after. */
+    __atomic_store_n(&__slot->seq, __pos + __i + 1, __ATOMIC_SEQ_CST);
+  }
+  if (__nr)
+    _mpmc_wake(&queue->deq_event, &queue->deq_waiters, __nr, flags);
+  return __nr;
+}
+static uint32_t _mpmc_dequeue(struct mpmc_queue *restrict queue,
+                              void *restrict elems, uint32_t nr, int flags,
+                              uint32_t **restrict seq32,
+                              uint32_t *restrict seq32_save) {
+  uint64_t __pos;
+  const uint32_t __nr =
+      _mpmc_claim(queue, &queue->pos_deq, 1, nr, &__pos, seq32, seq32_save);
+  for (uint32_t __i = 0; __i < __nr; ++__i) {
+    struct mpmc_slot *const restrict __slot = _mpmc_slot(queue, __pos + __i);
+    memcpy((unsigned char *)elems + (size_t)queue->elem_size * __i,
+           __slot->elem, queue->elem_size);
+    /* Free it for the next round with full memory barrier. */
+    __atomic_store_n(&__slot->seq, __pos + __i + queue->mask + 1,
+                     __ATOMIC_SEQ_CST);
+  }
+  if (__nr)
+    _mpmc_wake(&queue->enq_event, &queue->enq_waiters, __nr, flags);
+  return __nr;
+}
+
+int mpmc_try_enqueue(struct mpmc_queue *restrict queue,
+                     const void *restrict elem, int flags) {
+  uint32_t *__seq32, __seq32_save;
+  if (_mpmc_enqueue(queue, elem, 1, flags, &__seq32, &__seq32_save))
+    return 0;
+  errno = EAGAIN;
+  return -1;
+}
+int mpmc_try_dequeue(struct mpmc_queue *restrict queue, void *restrict elem,
+                     int flags) {
+  uint32_t *__seq32, __seq32_save;
+  if (_mpmc_dequeue(queue, elem, 1, flags, &__seq32, &__seq32_save))
+    return 0;
+  errno = EAGAIN;
+  return -1;
+}
+uint32_t mpmc_enqueue_batch(struct mpmc_queue *restrict queue,
+                            const void *restrict elems, uint32_t nr,
+                            int flags) {
+  uint32_t *__seq32, __seq32_save, __nr = 0;
+  while (__nr < nr) {
+    const uint32_t __ret = _mpmc_enqueue(
+        queue, (const unsigned char *)elems + (size_t)queue->elem_size * __nr,
+        nr - __nr, flags, &__seq32, &__seq32_save);
+    if (!__ret)
+      break;
+    __nr += __ret;
+  }
+  return __nr;
+}
+uint32_t mpmc_dequeue_batch(struct mpmc_queue *restrict queue,
+                            void *restrict elems, uint32_t nr, int flags) {
+  uint32_t *__seq32, __seq32_save, __nr = 0;
+  while (__nr < nr) {
+    const uint32_t __ret = _mpmc_dequeue(
+        queue, (unsigned char *)elems + (size_t)queue->elem_size * __nr,
+        nr - __nr, flags, &__seq32, &__seq32_save);
+    if (!__ret)
+      break;
+    __nr += __ret;
+  }
+  return __nr;
+}
+
+/*
+ * Sleep on `event` as one of `waiters` unless `retry` succeeds (until the
+ * absolute deadline `kernel_timeout`).
+ */
+#define _mpmc_wait(event, waiters, retry, flags, kernel_timeout)               \
+  ({                                                                           \
+    int __mpmc_ret = 0;                                                        \
+    const uint32_t __event_save = __atomic_load_n(event, __ATOMIC_ACQUIRE);    \
+    /* Announce the waiter (full barrier), then check again before sleep. */   \
+    __atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);                          \
+    if (!(retry)) {                                                            \
+      if (syscall(SYS_futex, event,                                            \
+                  ((flags) & FUTEX_PRIVATE_FLAG ? FUTEX_WAIT_BITSET_PRIVATE    \
+                                                : FUTEX_WAIT_BITSET) |         \
+                      ((flags) & FUTEX_CLOCK_REALTIME),                        \
+                  __event_save, kernel_timeout, NULL,                          \
+                  FUTEX_BITSET_MATCH_ANY) &&                                   \
+          errno != EAGAIN && !(errno == EINTR && (flags) & SA_RESTART))        \
+        __mpmc_ret = -1;                                                       \
+      else                                                                     \
+        __mpmc_ret = 1;                                                        \
+    }                                                                          \
+    const int __errno = errno;                                                 \
+    __atomic_sub_fetch(waiters, 1, __ATOMIC_RELAXED);                          \
+    errno = __errno;                                                           \
+    __mpmc_ret;                                                                \
+  })
+
+int mpmc_enqueue(struct mpmc_queue *restrict queue, const void *restrict elem,
+                 int flags, uint32_t user_timeout_tsc,
+                 const struct timespec *restrict kernel_timeout) {
+  const uint32_t __user_timeout_tsc_save = user_timeout_tsc;
+
+  uint32_t *__seq32, __seq32_save;
+  while (!_mpmc_enqueue(queue, elem, 1, flags, &__seq32,
+                        &__seq32_save)) { // Early trial.
+    /* Failed; Use usersched (snooping the slot). */
+    user_schedule(user_timeout_tsc, USERSCHED_COND_SCHEDULE) {
+      if (_mpmc_enqueue(queue, elem, 1, flags, &__seq32, &__seq32_save))
+        return 0;
+    }
+    user_reschedule(&user_timeout_tsc, __seq32, __seq32_save);
+
+    /* Usersched failed; Use the real system call. */
+    const int __ret =
+        _mpmc_wait(&queue->enq_event, &queue->enq_waiters,
+                   _mpmc_enqueue(queue, elem, 1, flags, &__seq32,
+                                 &__seq32_save),
+                   flags, kernel_timeout);
+    if (__ret == -1)
+      return -1;
+    if (!__ret)
+      return 0;
+    errno = 0;
+
+    if (flags & USERSCHED_RESTART)
+      user_timeout_tsc = __user_timeout_tsc_save;
+  }
+
+  return 0;
+}
+int mpmc_dequeue(struct mpmc_queue *restrict queue, void *restrict elem,
+                 int flags, uint32_t user_timeout_tsc,
+                 const struct timespec *restrict kernel_timeout) {
+  const uint32_t __user_timeout_tsc_save = user_timeout_tsc;
+
+  uint32_t *__seq32, __seq32_save;
+  while (!_mpmc_dequeue(queue, elem, 1, flags, &__seq32,
+                        &__seq32_save)) { // Early trial.
+    /* Failed; Use usersched (snooping the slot). */
+    user_schedule(user_timeout_tsc, USERSCHED_COND_SCHEDULE) {
+      if (_mpmc_dequeue(queue, elem, 1, flags, &__seq32, &__seq32_save))
+        return 0;
+    }
+    user_reschedule(&user_timeout_tsc, __seq32, __seq32_save);
+
+    /* Usersched failed; Use the real system call. */
+    const int __ret =
+        _mpmc_wait(&queue->deq_event, &queue->deq_waiters,
+                   _mpmc_dequeue(queue, elem, 1, flags, &__seq32,
+                                 &__seq32_save),
+                   flags, kernel_timeout);
+    if (__ret == -1)
+      return -1;
+    if (!__ret)
+      return 0;
+    errno = 0;
+
+    if (flags & USERSCHED_RESTART)
+      user_timeout_tsc = __user_timeout_tsc_save;
+  }
+
+  return 0;
+}
@@ -0,0 +1,94 @@
+#include "x86linux/helper.h"
+
+void spmc_ring_init(struct spmc_ring *restrict ring, uint32_t offset,
+                    uint32_t size) {
+  ring->pos_w = ring->pos_w_next = ring->gate = 0;
+  ring->mask = size - 1;
+  ring->offset = offset;
+  ring->active = ring->claimed = 0;
+}
+
+/*
+ * Minimum position of the active readers (`pos_w` if there is no one, as a
+ * joining reader starts from there)
+ */
+static uint64_t _spmc_ring_gate(const struct spmc_ring *restrict ring) {
+  uint64_t __gate = ring->pos_w;
+  bitset_t __active = __atomic_load_n(&ring->active, __ATOMIC_ACQUIRE);
+  while (__active) {
+    const uint64_t __pos = __atomic_load_n(
+        &(ring->readers + __builtin_ctzll(__active))->pos, __ATOMIC_ACQUIRE);
+    if (__pos < __gate)
+      __gate = __pos;
+    __active &= __active - 1;
+  }
+  return __gate;
+}
+
+void *spmc_ring_reserve(struct spmc_ring *restrict ring,
+                        uint32_t *restrict size) {
+  const uint64_t __pos_w = ring->pos_w_next;
+  const uint32_t __off = __pos_w & ring->mask;
+
+  uint64_t __free = ring->gate + ring->mask + 1 - __pos_w;
+  if (__free < *size) {
+    /* Re-calculate the gating position only when it looks full. */
+    ring->gate = _spmc_ring_gate(ring);
+    __free = ring->gate + ring->mask + 1 - __pos_w;
+  }
+  if (__free > ring->mask + 1 - __off)
+    __free = ring->mask + 1 - __off; // Contiguous one only
+  if (__free < *size)
+    *size = __free;
+  return likely(*size) ? (unsigned char *)spmc_ring_buf(ring) + __off : NULL;
+}
+
+int32_t spmc_ring_join(struct spmc_ring *restrict ring) {
+  for (;;) {
+    const bitset_t __claimed =
+        __atomic_load_n(&ring->claimed, __ATOMIC_RELAXED);
+    if (unlikely(!~__claimed))
+      return -1;
+    const uint32_t __id = __builtin_ctzll(~__claimed);
+    if (bitset_set_atomic64(&ring->claimed, __id))
+      continue; // Another reader has taken it.
+
+    /*
+     * Start from the current position, then move to the latest one after
+     * activating (with full memory barrier); Any write which the producer
+     * allowed before activating is behind the latter.
+     */
+    struct spmc_reader *const restrict __reader = ring->readers + __id;
+    __reader->pos = __reader->pos_next = __reader->pos_w_cache =
+        __atomic_load_n(&ring->pos_w, __ATOMIC_ACQUIRE);
+    bitset_set_atomic64(&ring->active, __id);
+    __reader->pos_next = __reader->pos_w_cache =
+        __atomic_load_n(&ring->pos_w, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&__reader->pos, __reader->pos_next, __ATOMIC_RELEASE);
+    return __id;
+  }
+}
+void spmc_ring_leave(struct spmc_ring *restrict ring, uint32_t id) {
+  bitset_unset_atomic64(&ring->active, id);
+  bitset_unset_atomic64(&ring->claimed, id); // Reusable after inactive
+}
+
+const void *spmc_ring_peek(struct spmc_ring *restrict ring, uint32_t id,
+                           uint32_t *restrict size) {
+  struct spmc_reader *const restrict __reader = ring->readers + id;
+  const uint64_t __pos_r = __reader->pos_next;
+  const uint32_t __off = __pos_r & ring->mask;
+
+  uint64_t __used = __reader->pos_w_cache - __pos_r;
+  if (__used < *size) {
+    /* Re-read the producer position only when it looks empty. */
+    __reader->pos_w_cache = __atomic_load_n(&ring->pos_w, __ATOMIC_ACQUIRE);
+    __used = __reader->pos_w_cache - __pos_r;
+  }
+  if (__used > ring->mask + 1 - __off)
+    __used = ring->mask + 1 - __off; // Contiguous one only
+  if (__used < *size)
+    *size = __used;
+  return likely(*size) ? (const unsigned char *)spmc_ring_buf(ring) + __off
+                       : NULL;
+}
@@ -2,8 +2,18 @@
 
 #ifndef __KERNEL__
 
+#include <fcntl.h>
 #include <string.h>
 
+#include <syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #endif
 
 uint32_t spsc_read_peek(uint32_t pos_r, uint32_t pos_w, uint32_t pos_end,
@@ -45,13 +55,13 @@ uint32_t spsc_write_peek(uint32_t pos_r, uint32_t pos_w, uint32_t pos_end,
 
 uint32_t spsc_read(const void *restrict buf, void *restrict dest,
                    uint32_t *restrict pos_r, uint32_t size) {
-  memcpy(dest, buf + *pos_r, size);
+  memcpy_tiered(dest, buf + *pos_r, size, MEMCPY_VEC_MIN, SIZE_MAX);
   __sync_fetch_and_add(pos_r, size); // (good for request-response throughput?)
   return size;
 }
 uint32_t spsc_write(void *restrict buf, const void *restrict src,
                     uint32_t *restrict pos_w, uint32_t size) {
-  memcpy(buf + *pos_w, src, size);
+  memcpy_tiered(buf + *pos_w, src, size, MEMCPY_VEC_MIN, MEMCPY_NT_MIN);
   __sync_fetch_and_add(pos_w, size); // This include full memory barrier.
   return size;
 }
@@ -75,6 +85,204 @@ int spsc_rewind_write(uint32_t pos_start, uint32_t pos_r,
   return 0;
 }
 
+void spsc_ring_init(struct spsc_ring *restrict ring, uint32_t offset,
+                    uint32_t size) {
+  ring->pos_w = ring->pos_w_next = ring->pos_r_cache = 0;
+  ring->pos_r = ring->pos_r_next = ring->pos_w_cache = 0;
+  ring->size = size;
+  ring->offset = offset;
+  ring->flags = 0;
+  ring->copy_vec_min = MEMCPY_VEC_MIN;
+  ring->copy_nt_min = MEMCPY_NT_MIN;
+  ring->waiters = 0;
+}
+void spsc_ring_init_copy(struct spsc_ring *restrict ring, uint32_t vec_min,
+                         uint32_t nt_min, int prefetch) {
+  ring->copy_vec_min = vec_min;
+  ring->copy_nt_min = nt_min;
+  if (prefetch)
+    ring->flags |= SPSC_RING_PREFETCH;
+  else
+    ring->flags &= ~SPSC_RING_PREFETCH;
+}
+
+/* Free size (across the end) */
+static __always_inline uint32_t _spsc_ring_free(uint32_t pos_r, uint32_t pos_w,
+                                                uint32_t size) {
+  return pos_r > pos_w ? pos_r - pos_w - 1 : size - pos_w + pos_r - 1;
+}
+/* Used size (across the end) */
+static __always_inline uint32_t _spsc_ring_used(uint32_t pos_r, uint32_t pos_w,
+                                                uint32_t size) {
+  return pos_w >= pos_r ? pos_w - pos_r : size - pos_r + pos_w;
+}
+
+uint32_t spsc_ring_write(struct spsc_ring *restrict ring,
+                         const void *restrict src, uint32_t size) {
+  const uint32_t __pos_w = ring->pos_w_next;
+
+  uint32_t __free = _spsc_ring_free(ring->pos_r_cache, __pos_w, ring->size);
+  if (__free < size) {
+    /* Re-read the opposite cursor only when it looks full. */
+    ring->pos_r_cache = __atomic_load_n(&ring->pos_r, __ATOMIC_ACQUIRE);
+    __free = _spsc_ring_free(ring->pos_r_cache, __pos_w, ring->size);
+    if (__free < size)
+      size = __free;
+  }
+  if (unlikely(!size))
+    return 0;
+
+  unsigned char *const restrict __buf = spsc_ring_buf(ring);
+  const uint32_t __tail = ring->size - __pos_w;
+  if (size < __tail || (ring->flags & SPSC_RING_MIRRORED)) {
+    memcpy_tiered(__buf + __pos_w, src, size, ring->copy_vec_min,
+                  ring->copy_nt_min);
+    spsc_ring_commit(ring, size);
+  } else {
+    memcpy_tiered(__buf + __pos_w, src, __tail, ring->copy_vec_min,
+                  ring->copy_nt_min);
+    memcpy_tiered(__buf, (const unsigned char *)src + __tail, size - __tail,
+                  ring->copy_vec_min, ring->copy_nt_min);
+    ring->pos_w_next = size - __tail;
+  }
+  spsc_ring_publish_write(ring); // This also publishes the pending commits.
+  return size;
+}
+uint32_t spsc_ring_read(struct spsc_ring *restrict ring, void *restrict dest,
+                        uint32_t size) {
+  const uint32_t __pos_r = ring->pos_r_next;
+
+  uint32_t __used = _spsc_ring_used(__pos_r, ring->pos_w_cache, ring->size);
+  if (__used < size) {
+    /* Re-read the opposite cursor only when it looks empty. */
+    ring->pos_w_cache = __atomic_load_n(&ring->pos_w, __ATOMIC_ACQUIRE);
+    __used = _spsc_ring_used(__pos_r, ring->pos_w_cache, ring->size);
+    if (__used < size)
+      size = __used;
+  }
+  if (unlikely(!size))
+    return 0;
+
+  const unsigned char *const restrict __buf = spsc_ring_buf(ring);
+  const uint32_t __tail = ring->size - __pos_r;
+  if (size < __tail || (ring->flags & SPSC_RING_MIRRORED)) {
+    memcpy_tiered(dest, __buf + __pos_r, size, ring->copy_vec_min, SIZE_MAX);
+    spsc_ring_release(ring, size);
+  } else {
+    memcpy_tiered(dest, __buf + __pos_r, __tail, ring->copy_vec_min,
+                  SIZE_MAX);
+    memcpy_tiered((unsigned char *)dest + __tail, __buf, size - __tail,
+                  ring->copy_vec_min, SIZE_MAX);
+    ring->pos_r_next = size - __tail;
+  }
+  spsc_ring_publish_read(ring); // This also publishes the pending releases.
+  return size;
+}
+
+/* Keep 1 byte before `pos_r` (0 means the end) to tell full from empty. */
+static __always_inline uint32_t
+_spsc_ring_write_peek(const struct spsc_ring *restrict ring, uint32_t pos_r,
+                      uint32_t pos_w, uint32_t size) {
+  if (ring->flags & SPSC_RING_MIRRORED) {
+    const uint32_t __free = _spsc_ring_free(pos_r, pos_w, ring->size);
+    return __free < size ? __free : size;
+  }
+  return spsc_write_peek(pos_r, pos_w, ring->size - !pos_r, size);
+}
+static __always_inline uint32_t
+_spsc_ring_read_peek(const struct spsc_ring *restrict ring, uint32_t pos_r,
+                     uint32_t pos_w, uint32_t size) {
+  if (ring->flags & SPSC_RING_MIRRORED) {
+    const uint32_t __used = _spsc_ring_used(pos_r, pos_w, ring->size);
+    return __used < size ? __used : size;
+  }
+  return spsc_read_peek(pos_r, pos_w, ring->size, size);
+}
+
+void *spsc_ring_reserve(struct spsc_ring *restrict ring,
+                        uint32_t *restrict size) {
+  const uint32_t __pos_w = ring->pos_w_next;
+
+  uint32_t __peek =
+      _spsc_ring_write_peek(ring, ring->pos_r_cache, __pos_w, *size);
+  if (__peek < *size) {
+    ring->pos_r_cache = __atomic_load_n(&ring->pos_r, __ATOMIC_ACQUIRE);
+    __peek = _spsc_ring_write_peek(ring, ring->pos_r_cache, __pos_w, *size);
+  }
+  *size = __peek;
+  return likely(__peek) ? (unsigned char *)spsc_ring_buf(ring) + __pos_w
+                        : NULL;
+}
+const void *spsc_ring_peek(struct spsc_ring *restrict ring,
+                           uint32_t *restrict size) {
+  const uint32_t __pos_r = ring->pos_r_next;
+
+  uint32_t __peek =
+      _spsc_ring_read_peek(ring, __pos_r, ring->pos_w_cache, *size);
+  if (__peek < *size) {
+    ring->pos_w_cache = __atomic_load_n(&ring->pos_w, __ATOMIC_ACQUIRE);
+    __peek = _spsc_ring_read_peek(ring, __pos_r, ring->pos_w_cache, *size);
+  }
+  *size = __peek;
+  if (unlikely(!__peek))
+    return NULL;
+
+  const unsigned char *const restrict __buf = spsc_ring_buf(ring);
+  if (ring->flags & SPSC_RING_PREFETCH) {
+    /* Prefetch the published data of the next peek (up to the end). */
+    uint32_t __next = __pos_r + __peek;
+    if (__next >= ring->size)
+      __next -= ring->size;
+    uint32_t __ahead = _spsc_ring_used(__next, ring->pos_w_cache, ring->size);
+    if (__ahead > SPSC_RING_PREFETCH_SIZE)
+      __ahead = SPSC_RING_PREFETCH_SIZE;
+    if (!(ring->flags & SPSC_RING_MIRRORED) && __ahead > ring->size - __next)
+      __ahead = ring->size - __next;
+    for (uint32_t __off = 0; __off < __ahead; __off += L1_CACHE_BYTES)
+      __builtin_prefetch(__buf + __next + __off, 0, 3);
+  }
+  return __buf + __pos_r;
+}
+
+void *spsc_ring_record_reserve(struct spsc_ring *restrict ring, uint32_t len) {
+  const uint32_t __size = SPSC_RECORD_SIZE(len);
+  if (unlikely(__size < len)) // Overflow
+    return NULL;
+
+  uint32_t __peek = __size;
+  struct spsc_record *restrict __record = spsc_ring_reserve(ring, &__peek);
+  if (unlikely(__peek < __size)) {
+    /* Fill the tail with the padding record only if it is all free. */
+    if (!__peek || ring->pos_w_next + __peek != ring->size ||
+        (ring->flags & SPSC_RING_MIRRORED))
+      return NULL;
+    *__record = (struct spsc_record){.size = __peek, .len = SPSC_RECORD_PAD};
+    spsc_ring_commit(ring, __peek);
+
+    __peek = __size;
+    __record = spsc_ring_reserve(ring, &__peek);
+    if (__peek < __size)
+      return NULL;
+  }
+  *__record = (struct spsc_record){.size = __size, .len = len};
+  return __record + 1;
+}
+const void *spsc_ring_record_peek(struct spsc_ring *restrict ring,
+                                  uint32_t *restrict len) {
+  for (;;) {
+    uint32_t __peek = sizeof(struct spsc_record);
+    const struct spsc_record *const restrict __record =
+        spsc_ring_peek(ring, &__peek);
+    if (!__record)
+      return NULL;
+    if (likely(__record->len != SPSC_RECORD_PAD)) {
+      *len = __record->len;
+      return __record + 1;
+    }
+    spsc_ring_release(ring, __record->size); // Skip the padding.
+  }
+}
+
 #ifndef __KERNEL__
 
 uint32_t usersched_spsc_prepare_read(uint32_t *restrict pos_r,
@@ -118,4 +326,445 @@ uint32_t usersched_spsc_prepare_write(const volatile uint32_t *restrict pos_r,
   return wpeek;
 }
 
+/*
+ * Map [0, `size`) of `fd` and map [`offset`, `size`) of it once more right
+ * after, within one reservation so that nothing can be mapped between.
+ */
+static void *_spsc_ring_mmap_mirror(int fd, size_t offset, size_t size) {
+  unsigned char *const __addr = mmap(NULL, size + (size - offset), PROT_NONE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (__addr == MAP_FAILED)
+    return MAP_FAILED;
+
+  if (mmap(__addr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd,
+           0) == MAP_FAILED ||
+      mmap(__addr + size, size - offset, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED) {
+    const int __errno = errno;
+    munmap(__addr, size + (size - offset));
+    errno = __errno;
+    return MAP_FAILED;
+  }
+  return __addr;
+}
+
+/* Take `fd` and map the (new if empty) mirrored ring of it. */
+static int _spsc_ring_mirror_map(struct spsc_ring_mirror *restrict mirror,
+                                 int fd, uint32_t size) {
+  struct stat __st;
+  if (fstat(fd, &__st) == -1)
+    goto err_close;
+
+  const int __create = !__st.st_size;
+  size_t __size;
+  if (__create) {
+    __size = PAGE_SIZE + align_val_page((size_t)size);
+    if (unlikely(!size || __size - PAGE_SIZE > UINT32_MAX)) {
+      errno = EINVAL;
+      goto err_close;
+    }
+    if (ftruncate(fd, __size) == -1)
+      goto err_close;
+  } else {
+    __size = __st.st_size;
+    if (__size <= PAGE_SIZE || __size % PAGE_SIZE ||
+        __size - PAGE_SIZE > UINT32_MAX ||
+        (size && align_val_page((size_t)size) != __size - PAGE_SIZE)) {
+      errno = EINVAL;
+      goto err_close;
+    }
+  }
+
+  /* The ring occupies the first page, and the data follows. */
+  struct spsc_ring *const restrict __ring =
+      _spsc_ring_mmap_mirror(fd, PAGE_SIZE, __size);
+  if (__ring == MAP_FAILED)
+    goto err_close;
+  if (__create) {
+    spsc_ring_init(__ring, PAGE_SIZE, __size - PAGE_SIZE);
+    __ring->flags |= SPSC_RING_MIRRORED;
+  } else if (__ring->offset != PAGE_SIZE ||
+             __ring->size != __size - PAGE_SIZE ||
+             !(__ring->flags & SPSC_RING_MIRRORED)) {
+    /* Not a ring, or not initialized yet */
+    munmap(__ring, __size + (__size - PAGE_SIZE));
+    errno = EINVAL;
+    goto err_close;
+  }
+
+  mirror->ring = __ring;
+  mirror->size = __size + (__size - PAGE_SIZE);
+  mirror->fd = fd;
+  return 0;
+
+err_close:;
+  const int __errno = errno;
+  close(fd);
+  errno = __errno;
+  return -1;
+}
+
+int spsc_ring_mirror_open(struct spsc_ring_mirror *restrict mirror,
+                          uint32_t size) {
+  const int __fd = memfd_create("spsc_ring", MFD_CLOEXEC);
+  if (__fd == -1)
+    return -1;
+  return _spsc_ring_mirror_map(mirror, __fd, size);
+}
+int spsc_ring_mirror_attach(struct spsc_ring_mirror *restrict mirror, int fd) {
+  return _spsc_ring_mirror_map(mirror, fd, 0);
+}
+int spsc_ring_shm_open(struct spsc_ring_mirror *restrict mirror,
+                       const char *restrict name, uint32_t size, int oflag,
+                       mode_t mode) {
+  const int __fd = shm_open(name, oflag, mode);
+  if (__fd == -1)
+    return -1;
+  return _spsc_ring_mirror_map(mirror, __fd, size);
+}
+int spsc_ring_mirror_close(struct spsc_ring_mirror *restrict mirror) {
+  if (munmap(mirror->ring, mirror->size) == -1)
+    return -1;
+  return close(mirror->fd);
+}
+
+int spsc_ring_dev_open(struct spsc_ring_mirror *restrict mirror,
+                       uint32_t size) {
+  const int __fd = open("/dev/" SPSC_DEV_NAME, O_RDWR | O_CLOEXEC);
+  if (__fd == -1)
+    return -1;
+  if (ioctl(__fd, SPSC_DEV_IOC_INIT, &size) == -1)
+    goto err_close;
+
+  const size_t __size = PAGE_SIZE + align_val_page(size);
+  void *const __ring =
+      mmap(NULL, __size, PROT_READ | PROT_WRITE, MAP_SHARED, __fd, 0);
+  if (__ring == MAP_FAILED)
+    goto err_close;
+  mirror->ring = (struct spsc_ring *)__ring;
+  mirror->size = __size;
+  mirror->fd = __fd;
+  return 0;
+
+err_close:;
+  const int __errno = errno;
+  close(__fd);
+  errno = __errno;
+  return -1;
+}
+static int _spsc_ring_dev_kick(struct spsc_ring_mirror *restrict mirror) {
+  /* Pair with the arming. */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (likely(!(__atomic_load_n(&mirror->ring->waiters, __ATOMIC_RELAXED) &
+               SPSC_RING_WAIT_DOORBELL)))
+    return 0;
+  return ioctl(mirror->fd, SPSC_DEV_IOC_KICK) == -1 ? -1 : 0;
+}
+int spsc_ring_dev_publish_write(struct spsc_ring_mirror *restrict mirror) {
+  spsc_ring_publish_write(mirror->ring);
+  return _spsc_ring_dev_kick(mirror);
+}
+int spsc_ring_dev_publish_read(struct spsc_ring_mirror *restrict mirror) {
+  spsc_ring_publish_read(mirror->ring);
+  return _spsc_ring_dev_kick(mirror);
+}
+
+static int _spsc_ring_check_read(struct spsc_ring *restrict ring, uint32_t size,
+                                 uint32_t *restrict pos_w_save) {
+  *pos_w_save = ring->pos_w_cache =
+      __atomic_load_n(&ring->pos_w, __ATOMIC_ACQUIRE);
+  return _spsc_ring_used(ring->pos_r_next, *pos_w_save, ring->size) >= size;
+}
+static int _spsc_ring_check_write(struct spsc_ring *restrict ring,
+                                  uint32_t size,
+                                  uint32_t *restrict pos_r_save) {
+  *pos_r_save = ring->pos_r_cache =
+      __atomic_load_n(&ring->pos_r, __ATOMIC_ACQUIRE);
+  return _spsc_ring_free(*pos_r_save, ring->pos_w_next, ring->size) >= size;
+}
+
+/* Wait on `cursor` (which is `cursor_save`) as `waiter` until `abs_timeout`. */
+static int _spsc_ring_futex_wait(struct spsc_ring *restrict ring,
+                                 uint32_t *restrict cursor,
+                                 uint32_t cursor_save, uint32_t waiter,
+                                 int flags,
+                                 const struct timespec *restrict abs_timeout) {
+  const long __ret =
+      syscall(SYS_futex, cursor,
+              (flags & FUTEX_PRIVATE_FLAG ? FUTEX_WAIT_BITSET_PRIVATE
+                                          : FUTEX_WAIT_BITSET) |
+                  (flags & FUTEX_CLOCK_REALTIME),
+              cursor_save, abs_timeout, NULL, FUTEX_BITSET_MATCH_ANY);
+  const int __errno = errno;
+  __atomic_and_fetch(&ring->waiters, ~waiter, __ATOMIC_RELAXED);
+  if (__ret && !(__ret == -1 && __errno == EAGAIN) &&
+      !(__errno == EINTR && flags & SA_RESTART)) {
+    errno = __errno;
+    return -1;
+  }
+  errno = 0;
+  return 0;
+}
+
+int spsc_ring_wait_read(struct spsc_ring *restrict ring, uint32_t size,
+                        int flags, uint32_t user_timeout_tsc,
+                        const struct timespec *restrict kernel_timeout) {
+  const uint32_t __user_timeout_tsc_save = user_timeout_tsc;
+  const volatile uint32_t *const restrict __pos_w = &ring->pos_w;
+
+  uint32_t __pos_w_save;
+  while (!_spsc_ring_check_read(ring, size, &__pos_w_save)) { // Early trial.
+    /* Failed; Use usersched. */
+    user_schedule(user_timeout_tsc, USERSCHED_COND_SCHEDULE) {
+      if (_spsc_ring_check_read(ring, size, &__pos_w_save))
+        return 0;
+    }
+    user_reschedule(&user_timeout_tsc, __pos_w, __pos_w_save);
+
+    /* Announce the waiter (full barrier), then check again before sleep. */
+    __atomic_or_fetch(&ring->waiters, SPSC_RING_WAIT_READ, __ATOMIC_SEQ_CST);
+    if (_spsc_ring_check_read(ring, size, &__pos_w_save)) {
+      __atomic_and_fetch(&ring->waiters, ~SPSC_RING_WAIT_READ,
+                         __ATOMIC_RELAXED);
+      return 0;
+    }
+
+    /* Usersched failed; Use the real system call. */
+    if (_spsc_ring_futex_wait(ring, &ring->pos_w, __pos_w_save,
+                              SPSC_RING_WAIT_READ, flags, kernel_timeout))
+      return -1;
+
+    if (flags & USERSCHED_RESTART)
+      user_timeout_tsc = __user_timeout_tsc_save;
+  }
+
+  return 0;
+}
+int spsc_ring_wait_write(struct spsc_ring *restrict ring, uint32_t size,
+                         int flags, uint32_t user_timeout_tsc,
+                         const struct timespec *restrict kernel_timeout) {
+  const uint32_t __user_timeout_tsc_save = user_timeout_tsc;
+  const volatile uint32_t *const restrict __pos_r = &ring->pos_r;
+
+  uint32_t __pos_r_save;
+  while (!_spsc_ring_check_write(ring, size, &__pos_r_save)) { // Early trial.
+    /* Failed; Use usersched. */
+    user_schedule(user_timeout_tsc, USERSCHED_COND_SCHEDULE) {
+      if (_spsc_ring_check_write(ring, size, &__pos_r_save))
+        return 0;
+    }
+    user_reschedule(&user_timeout_tsc, __pos_r, __pos_r_save);
+
+    /* Announce the waiter (full barrier), then check again before sleep. */
+    __atomic_or_fetch(&ring->waiters, SPSC_RING_WAIT_WRITE, __ATOMIC_SEQ_CST);
+    if (_spsc_ring_check_write(ring, size, &__pos_r_save)) {
+      __atomic_and_fetch(&ring->waiters, ~SPSC_RING_WAIT_WRITE,
+                         __ATOMIC_RELAXED);
+      return 0;
+    }
+
+    /* Usersched failed; Use the real system call. */
+    if (_spsc_ring_futex_wait(ring, &ring->pos_r, __pos_r_save,
+                              SPSC_RING_WAIT_WRITE, flags, kernel_timeout))
+      return -1;
+
+    if (flags & USERSCHED_RESTART)
+      user_timeout_tsc = __user_timeout_tsc_save;
+  }
+
+  return 0;
+}
+
+/* Wake up the opposite side sleeping on `cursor` (if any) as `waiter`. */
+static int _spsc_ring_wake(struct spsc_ring *restrict ring,
+                           uint32_t *restrict cursor, uint32_t waiter,
+                           int flags) {
+  /* Pair with the announcement of the waiter. */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (likely(!(__atomic_load_n(&ring->waiters, __ATOMIC_RELAXED) & waiter)))
+    return 0;
+  return syscall(SYS_futex, cursor,
+                 flags & FUTEX_PRIVATE_FLAG ? FUTEX_WAKE_PRIVATE : FUTEX_WAKE,
+                 INT_MAX, NULL, NULL, 0) == -1
+             ? -1
+             : 0;
+}
+int spsc_ring_publish_write_wake(struct spsc_ring *restrict ring, int flags) {
+  spsc_ring_publish_write(ring);
+  return _spsc_ring_wake(ring, &ring->pos_w, SPSC_RING_WAIT_READ, flags);
+}
+int spsc_ring_publish_read_wake(struct spsc_ring *restrict ring, int flags) {
+  spsc_ring_publish_read(ring);
+  return _spsc_ring_wake(ring, &ring->pos_r, SPSC_RING_WAIT_WRITE, flags);
+}
+
+int spsc_ring_doorbell_open(struct spsc_ring_doorbell *restrict doorbell,
+                            struct spsc_ring *restrict ring) {
+  const int __fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (__fd == -1)
+    return -1;
+  spsc_ring_doorbell_attach(doorbell, ring, __fd);
+  return 0;
+}
+int spsc_ring_doorbell_close(struct spsc_ring_doorbell *restrict doorbell) {
+  return close(doorbell->fd);
+}
+int spsc_ring_doorbell_arm(struct spsc_ring_doorbell *restrict doorbell) {
+  struct spsc_ring *const restrict __ring = doorbell->ring;
+
+  eventfd_t __cnt;
+  if (eventfd_read(doorbell->fd, &__cnt) && errno != EAGAIN)
+    return -1;
+
+  /* Arm (full barrier), then check again not to miss the publish before. */
+  __atomic_or_fetch(&__ring->waiters, SPSC_RING_WAIT_DOORBELL,
+                    __ATOMIC_SEQ_CST);
+  __ring->pos_w_cache = __atomic_load_n(&__ring->pos_w, __ATOMIC_ACQUIRE);
+  if (__ring->pos_w_cache != __ring->pos_r_next) {
+    __atomic_and_fetch(&__ring->waiters, ~SPSC_RING_WAIT_DOORBELL,
+                       __ATOMIC_RELAXED);
+    return 1;
+  }
+  return 0;
+}
+int spsc_ring_publish_write_doorbell(
+    struct spsc_ring_doorbell *restrict doorbell) {
+  struct spsc_ring *const restrict __ring = doorbell->ring;
+
+  spsc_ring_publish_write(__ring);
+  /* Pair with the arming. */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (likely(!(__atomic_load_n(&__ring->waiters, __ATOMIC_RELAXED) &
+               SPSC_RING_WAIT_DOORBELL)))
+    return 0;
+  /* Disarm (unless the consumer has done it). */
+  if (!(__atomic_fetch_and(&__ring->waiters, ~SPSC_RING_WAIT_DOORBELL,
+                           __ATOMIC_RELAXED) &
+        SPSC_RING_WAIT_DOORBELL))
+    return 0;
+  return eventfd_write(doorbell->fd, 1);
+}
+
+/* Absolute TSC of `abs_timeout` (0 if expired, UINT64_MAX if NULL) */
+static unsigned long long
+_spsc_ring_deadline_tsc(int flags,
+                        const struct timespec *restrict abs_timeout) {
+  if (!abs_timeout)
+    return UINT64_MAX;
+
+  struct timespec __now;
+  clock_gettime(flags & FUTEX_CLOCK_REALTIME ? CLOCK_REALTIME : CLOCK_MONOTONIC,
+                &__now);
+  const int64_t __ns = (abs_timeout->tv_sec - __now.tv_sec) * 1000000000ll +
+                       (abs_timeout->tv_nsec - __now.tv_nsec);
+  if (__ns <= 0)
+    return 0;
+  return _rdtsc() + (unsigned __int128)__ns * usersched_tsc_freq_hz /
+                        1000000000;
+}
+
+/* Wait until the ring is not full (if `write`) or not empty. */
+static int _spsc_ring_wait(struct spsc_ring *restrict ring, int write,
+                           int flags, uint32_t spin_tsc, uint32_t umwait_tsc,
+                           const struct timespec *restrict abs_timeout) {
+  uint32_t *const restrict __cursor = write ? &ring->pos_r : &ring->pos_w;
+  const uint32_t __waiter = write ? SPSC_RING_WAIT_WRITE : SPSC_RING_WAIT_READ;
+  uint32_t __cursor_save;
+#define _spsc_ring_ready()                                                     \
+  (write ? _spsc_ring_check_write(ring, 1, &__cursor_save)                     \
+         : _spsc_ring_check_read(ring, 1, &__cursor_save))
+
+  if (_spsc_ring_ready())
+    return 0;
+
+  /* All stages share the one deadline. */
+  const unsigned long long __deadline_tsc =
+      _spsc_ring_deadline_tsc(flags, abs_timeout);
+  const unsigned long long __tsc = _rdtsc();
+
+  /* Stage 1: Spin with PAUSE. */
+  const unsigned long long __spin_tsc =
+      __tsc + spin_tsc < __deadline_tsc ? __tsc + spin_tsc : __deadline_tsc;
+  while (_rdtsc() < __spin_tsc) {
+    _mm_pause();
+    if (_spsc_ring_ready())
+      return 0;
+  }
+
+  /* Stage 2: UMWAIT on the cache line of the opposite cursor (if supported). */
+  const unsigned long long __umwait_tsc =
+      __spin_tsc + umwait_tsc < __deadline_tsc ? __spin_tsc + umwait_tsc
+                                               : __deadline_tsc;
+  while (_rdtsc() < __umwait_tsc) {
+    user_wait(__cursor, __cursor_save, 0, __umwait_tsc);
+    if (_spsc_ring_ready())
+      return 0;
+  }
+
+  /* Stage 3: Sleep on the futex until the deadline. */
+  for (;;) {
+    if (unlikely(!__deadline_tsc)) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+
+    /* Announce the waiter (full barrier), then check again before sleep. */
+    __atomic_or_fetch(&ring->waiters, __waiter, __ATOMIC_SEQ_CST);
+    if (_spsc_ring_ready()) {
+      __atomic_and_fetch(&ring->waiters, ~__waiter, __ATOMIC_RELAXED);
+      return 0;
+    }
+
+    const long __ret = syscall(
+        SYS_futex, __cursor,
+        (flags & FUTEX_PRIVATE_FLAG ? FUTEX_WAIT_BITSET_PRIVATE
+                                    : FUTEX_WAIT_BITSET) |
+            (flags & FUTEX_CLOCK_REALTIME),
+        __cursor_save, abs_timeout, NULL, FUTEX_BITSET_MATCH_ANY);
+    const int __errno = errno;
+    __atomic_and_fetch(&ring->waiters, ~__waiter, __ATOMIC_RELAXED);
+    if (__ret && __errno != EAGAIN &&
+        !(__errno == EINTR && flags & SA_RESTART)) {
+      errno = __errno;
+      return -1;
+    }
+    if (_spsc_ring_ready())
+      return 0;
+  }
+#undef _spsc_ring_ready
+}
+
+const void *spsc_ring_peek_wait(struct spsc_ring *restrict ring,
+                                uint32_t *restrict size, int flags,
+                                uint32_t spin_tsc, uint32_t umwait_tsc,
+                                const struct timespec *restrict abs_timeout) {
+  const uint32_t __size = *size;
+  const void *__ptr = spsc_ring_peek(ring, size);
+  if (likely(__ptr))
+    return __ptr;
+
+  /* Publish the pending releases not to block the producer. */
+  spsc_ring_publish_read_wake(ring, flags);
+  if (_spsc_ring_wait(ring, 0, flags, spin_tsc, umwait_tsc, abs_timeout))
+    return NULL;
+  *size = __size;
+  return spsc_ring_peek(ring, size);
+}
+void *spsc_ring_reserve_wait(struct spsc_ring *restrict ring,
+                             uint32_t *restrict size, int flags,
+                             uint32_t spin_tsc, uint32_t umwait_tsc,
+                             const struct timespec *restrict abs_timeout) {
+  const uint32_t __size = *size;
+  void *__ptr = spsc_ring_reserve(ring, size);
+  if (likely(__ptr))
+    return __ptr;
+
+  /* Publish the pending commits not to block the consumer. */
+  spsc_ring_publish_write_wake(ring, flags);
+  if (_spsc_ring_wait(ring, 1, flags, spin_tsc, umwait_tsc, abs_timeout))
+    return NULL;
+  *size = __size;
+  return spsc_ring_reserve(ring, size);
+}
+
 #endif
@@ -276,6 +276,70 @@ int usersched_punlock_pi(volatile uint32_t *restrict lock, pid_t tid, int flags,
   return 0;
 }
 
+static uint32_t
+_usersched_poll_scan(const struct usersched_watch *restrict watches,
+                     uint32_t nr, bitset_t *restrict changed) {
+  uint32_t __cnt = 0;
+  for (uint32_t __idx = 0; __idx < nr; __idx += BITS_PER_BITSET) {
+    const uint32_t __nr =
+        nr - __idx < BITS_PER_BITSET ? nr - __idx : BITS_PER_BITSET;
+    bitset_t __word = 0;
+    for (uint32_t __i = 0; __i < __nr; ++__i) {
+      const struct usersched_watch *const restrict __watch =
+          watches + __idx + __i;
+      const uint32_t __val =
+          __atomic_load_n(__watch->uaddr32, __ATOMIC_ACQUIRE);
+      __word |= (bitset_t)(__val != __watch->oldval32) << __i;
+    }
+    *(changed + __idx / BITS_PER_BITSET) = __word;
+    __cnt += __builtin_popcountll(__word);
+  }
+  return __cnt;
+}
+int usersched_poll(const struct usersched_watch *restrict watches, uint32_t nr,
+                   bitset_t *restrict changed, int flags,
+                   uint32_t user_timeout_tsc,
+                   const struct timespec *restrict abs_timeout) {
+  if (unlikely(!nr || nr > USERSCHED_POLL_MAX)) {
+    errno = EINVAL;
+    return -1;
+  }
+  const uint32_t __user_timeout_tsc_save = user_timeout_tsc;
+
+  struct futex_waitv __waitv[nr];
+  for (uint32_t __i = 0; __i < nr; ++__i)
+    __waitv[__i] = (struct futex_waitv){
+        .val = (watches + __i)->oldval32,
+        .uaddr = (uintptr_t)(watches + __i)->uaddr32,
+        .flags = FUTEX_32 | (flags & FUTEX_PRIVATE_FLAG),
+    };
+
+  uint32_t __cnt;
+  while (!(__cnt = _usersched_poll_scan(watches, nr,
+                                        changed))) { // Early trial.
+    /* Failed; Use usersched (UMWAIT cannot snoop all of them). */
+    user_schedule(user_timeout_tsc, USERSCHED_COND_SCHEDULE) {
+      if ((__cnt = _usersched_poll_scan(watches, nr, changed)))
+        return __cnt;
+      _mm_pause();
+    }
+    user_reschedule(&user_timeout_tsc, NULL, 0);
+
+    /* Usersched failed; Use the real system call. */
+    if (syscall(SYS_futex_waitv, __waitv, nr, 0, abs_timeout,
+                flags & FUTEX_CLOCK_REALTIME ? CLOCK_REALTIME
+                                             : CLOCK_MONOTONIC) == -1 &&
+        errno != EAGAIN && !(errno == EINTR && flags & SA_RESTART))
+      return -1;
+    errno = 0;
+
+    if (flags & USERSCHED_RESTART)
+      user_timeout_tsc = __user_timeout_tsc_save;
+  }
+
+  return __cnt;
+}
+
 /* Initialization */
 
 static volatile int _usersched_inited;
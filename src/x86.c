@@ -0,0 +1,31 @@
+#include "x86linux/helper.h"
+
+int x86_support_avx2;
+int x86_support_avx512;
+
+static __attribute((constructor(101))) void _x86_pre_init() {
+  uint32_t __eax = 0, __ebx, __ecx;
+
+  /* Check the highest basic CPUID leaf. */
+  x86_cpuid(&__eax, NULL, NULL, NULL);
+  if (__eax < 7)
+    return;
+
+  /* Check AVX and OSXSAVE support first. */
+  __eax = 1;
+  x86_cpuid(&__eax, NULL, &__ecx, NULL);
+  if ((__ecx & (1 << 27 | 1 << 28)) != (1 << 27 | 1 << 28))
+    return;
+
+  /* Check if the OS saves XMM/YMM (and opmask/ZMM) state. */
+  const uint64_t __xcr0 = x86_xgetbv(0);
+  if ((__xcr0 & 0x6) != 0x6)
+    return;
+
+  __eax = 7, __ecx = 0;
+  x86_cpuidex(&__eax, &__ebx, &__ecx, NULL);
+  x86_support_avx2 = !!(__ebx & (1 << 5));
+  x86_support_avx512 = (__xcr0 & 0xE6) == 0xE6 &&
+                       (__ebx & (1 << 16 | 1 << 30 | 1u << 31)) ==
+                           (1 << 16 | 1 << 30 | 1u << 31);
+}
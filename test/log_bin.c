@@ -0,0 +1,109 @@
+#include "x86linux/helper.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Binary stream: encode, decode it back, then decode the broken ones. */
+
+static size_t _read_all(int fd, char *restrict buf, size_t size) {
+  size_t __len = 0;
+  ssize_t __ret;
+  log_verify(lseek(fd, 0, SEEK_SET) == 0);
+  while (__len < size - 1 &&
+         (__ret = read(fd, buf + __len, size - 1 - __len)) > 0)
+    __len += __ret;
+  buf[__len] = '\0';
+  return __len;
+}
+/* Decode `size` byte(s) of `stream` and return the result of it. */
+static int _decode(const char *restrict stream, size_t size,
+                   char *restrict text, size_t text_size) {
+  const int __in = memfd_create("log_bin_in", MFD_CLOEXEC);
+  const int __out = memfd_create("log_bin_out", MFD_CLOEXEC);
+  log_verify(__in >= 0 && __out >= 0);
+  log_verify(write(__in, stream, size) == (ssize_t)size);
+  log_verify(lseek(__in, 0, SEEK_SET) == 0);
+
+  const int __ret = log_bin_decode(__in, __out);
+  log_verify(!__ret || errno == EBADMSG);
+  if (text)
+    _read_all(__out, text, text_size);
+  close(__in);
+  close(__out);
+  return __ret;
+}
+
+int main() {
+  static char __stream[1 << 16], __text[1 << 16];
+
+  LOG_INIT();
+  log_enable(LOG_DEBUG);
+  const int __fd = memfd_create("log_bin", MFD_CLOEXEC);
+  log_verify(__fd >= 0);
+  log_verify(!log_async_start(0, LOG_ASYNC_BLOCK));
+  log_verify(!log_bin_open(__fd));
+
+  /* The string without '\0' right before the unmapped page */
+  const long __page = sysconf(_SC_PAGESIZE);
+  char *const __map = mmap(NULL, 2 * __page, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  log_verify(__map != MAP_FAILED);
+  log_verify(!mprotect(__map + __page, __page, PROT_NONE));
+  char *const __end = __map + __page - 3;
+  memcpy(__end, "AAA", 3);
+
+  log_bin(LOG_INFO, "int %d long %ld double %.2f", -1, 1l << 40, 0.5);
+  log_bin(LOG_INFO, "fixed [%.3s]", __end);
+  log_bin(LOG_INFO, "star [%.*s]", 2, __end);
+  log_bin(LOG_INFO, "width [%*.*s]", 5, 3, __end);
+  log_bin(LOG_INFO, "negative [%.*s]", -1, "full");
+  log_bin(LOG_INFO, "null [%s] [%.3s]", (char *)NULL, (char *)NULL);
+  log_bin(LOG_INFO, "zero [%.0s] [%.s]", __end, __end);
+
+  log_bin_close();
+  log_async_stop();
+
+  /* Decode it back. */
+  const size_t __size = _read_all(__fd, __stream, sizeof(__stream));
+  log_verify(__size);
+  log_verify(!_decode(__stream, __size, __text, sizeof(__text)));
+  static const char *const __expected[] = {
+      "int -1 long 1099511627776 double 0.50",
+      "fixed [AAA]",
+      "star [AA]",
+      "width [  AAA]",
+      "negative [full]",
+      "null [(null)] []",
+      "zero [] []",
+  };
+  for (size_t __i = 0; __i < sizeof(__expected) / sizeof(*__expected); ++__i)
+    if (!strstr(__text, __expected[__i])) {
+      fprintf(stderr, "missing `%s' in:\n%s", __expected[__i], __text);
+      return 1;
+    }
+
+  /* Truncated ones (the complete records are still decoded) */
+  for (size_t __len = 0; __len < __size; ++__len)
+    _decode(__stream, __len, NULL, 0);
+
+  /* Corrupt ones */
+  static char __broken[sizeof(__stream)];
+  srand(0);
+  for (int __i = 0; __i < 4096; ++__i) {
+    memcpy(__broken, __stream, __size);
+    for (int __j = 0; __j < 1 + __i % 4; ++__j)
+      __broken[rand() % __size] = rand();
+    _decode(__broken, __size, NULL, 0);
+  }
+  /* The largest record size */
+  memcpy(__broken, __stream, __size);
+  const uint32_t __max = UINT32_MAX;
+  memcpy(__broken + ((const struct log_bin_record *)__stream)->size, &__max,
+         sizeof(__max));
+  log_verify(_decode(__broken, __size, NULL, 0) == -1 && errno == EBADMSG);
+
+  munmap(__map, 2 * __page);
+  close(__fd);
+  return 0;
+}